@@ -1,19 +1,32 @@
 #include <pebble.h>
 #include "battery_layer.h"
+#include "metrics.h"
+#include "power.h"
 
 const uint32_t BATTERY_TIMEOUT = 2000; // 2 second animation 
 const uint8_t  MAX_DOTS = 4;
 
-static Layer *battery_layer;
+static Layer *battery_layer = NULL;
+static GRect battery_frame;
+static Window *battery_window;
 
 static AppTimer *battery_animation_timer;
 static bool is_animating = false;
 static bool is_enabled   = false;
 static int8_t dots = 4; 
 
-static void handle_battery(BatteryChargeState charge_state) 
+/*
+ * Called by the power module, which owns the battery state service. The layer is
+ * only redrawn when the number of dots changes.
+ */
+void battery_state_changed(BatteryChargeState charge_state) 
 {
-  if (charge_state.is_charging || charge_state.is_plugged) {
+  if (!is_enabled) {
+    return;
+  }
+
+  // The charging animation is left out when saving power
+  if ((charge_state.is_charging || charge_state.is_plugged) && power_animations_enabled()) {
 
     if (!is_animating) {
        is_animating = true;
@@ -22,34 +35,48 @@ static void handle_battery(BatteryChargeState charge_state)
     return;
 
   } 
-  else {
-
-    is_animating = false;
-    if (battery_animation_timer) {
-      app_timer_cancel(battery_animation_timer);
-    }
-    
-    uint8_t charge = charge_state.charge_percent;
-    if (charge >= 90) {
-      dots = MAX_DOTS;
-    } else if (charge >= 65 && charge < 90) {
-      dots = 3;
-    } else if (charge >= 35 && charge < 65) {
-      dots = 2;
-    } else {
-      dots = 1;
-    }
+  
+  bool was_animating = is_animating;
+  is_animating = false;
+  if (was_animating && battery_animation_timer) {
+    app_timer_cancel(battery_animation_timer);
+    battery_animation_timer = NULL;
+  }
+  
+  int8_t new_dots;
+  uint8_t charge = charge_state.charge_percent;
+  if (charge >= 90) {
+    new_dots = MAX_DOTS;
+  } else if (charge >= 65 && charge < 90) {
+    new_dots = 3;
+  } else if (charge >= 35 && charge < 65) {
+    new_dots = 2;
+  } else {
+    new_dots = 1;
   }
 
+  if (new_dots == dots && !was_animating) {
+    return;
+  }
+  dots = new_dots;
   layer_mark_dirty(battery_layer);
 }
 
 
+/*
+ * Only remembers where the layer goes, it is created the first time it is shown
+ */
 void battery_layer_create(GRect frame, Window *window)
 {
-  battery_layer = layer_create(frame);
+  battery_frame = frame;
+  battery_window = window;
+}
+
+static void battery_layer_realize()
+{
+  battery_layer = layer_create(battery_frame);
   layer_set_update_proc(battery_layer, battery_layer_update);
-  layer_add_child(window_get_root_layer(window), battery_layer);
+  layer_add_child(window_get_root_layer(battery_window), battery_layer);
 }
 
 void battery_enable_display() 
@@ -61,11 +88,13 @@ void battery_enable_display()
   is_animating = false;
   is_enabled = true;
 
-  // Kickoff first update
-  handle_battery(battery_state_service_peek());
+  if (battery_layer == NULL) {
+    battery_layer_realize();
+  }
 
-  // Subscribe to the battery monitoring service
-  battery_state_service_subscribe(&handle_battery);
+  // Kickoff first update, the dots may not have been drawn while hidden
+  dots = 0;
+  battery_state_changed(battery_state_service_peek());
 
   layer_set_hidden(battery_layer, false);
 }
@@ -75,19 +104,20 @@ void battery_disable_display()
   is_animating = false;
   is_enabled = false;
 
-  layer_set_hidden(battery_layer, true);
-
-  // Unsubscribe to the battery monitoring service
-  battery_state_service_unsubscribe();
+  if (battery_layer != NULL) {
+    layer_set_hidden(battery_layer, true);
+  }
 
   // Kill the timer
   if (battery_animation_timer) {
     app_timer_cancel(battery_animation_timer);
+    battery_animation_timer = NULL;
   }
 }
 
 void battery_timer_callback()
 {
+  metrics_count(METRIC_WAKEUPS);
   dots++;
   if (dots > MAX_DOTS) {
     dots = 1;
@@ -115,7 +145,10 @@ void battery_layer_update(Layer *me, GContext *ctx)
 void battery_layer_destroy() 
 {
   battery_disable_display();
-  layer_destroy(battery_layer);
+  if (battery_layer != NULL) {
+    layer_destroy(battery_layer);
+    battery_layer = NULL;
+  }
 }
 
 
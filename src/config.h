@@ -4,8 +4,16 @@
 #define DEFAULT_WEATHER_SERVICE "yahoo"
 #define DEFAULT_DISPLAY_BATTERY true
 
+// Settings kept under separate keys before KEY_SETTINGS_RECORD, only read to migrate
 #define KEY_DEBUG_MODE 0
 #define KEY_WEATHER_SERVICE 1
 #define KEY_WEATHER_SCALE 2
 #define KEY_DISPLAY_BATTERY 3
 
+// Persisted records
+#define KEY_WEATHER_RECORD 4
+#define KEY_WEATHER_LOCALE 5
+#define KEY_METRICS_RECORD 6
+#define KEY_EVENT_LOG_RECORD 7
+#define KEY_SETTINGS_RECORD 8
+
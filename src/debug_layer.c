@@ -1,23 +1,46 @@
 #include <pebble.h>
 #include "network.h"
 #include "debug_layer.h"
+#include "latency.h"
+#include "metrics.h"
 
-static TextLayer *debug_layer;
+static TextLayer *debug_layer = NULL;
+static GRect debug_frame;
+static Window *debug_window;
 
 static char last_update_text[] = "00:00";
 static char debug_msg[200];
 
 static bool is_enabled = false;
 
+/* The debug readout cycles through these pages, one per minute, followed by the
+   pages of the metrics */
+typedef enum {
+  DEBUG_PAGE_WEATHER = 0,
+  DEBUG_PAGE_LATENCY,
+  DEBUG_PAGE_METRICS
+} DebugPage;
+
+static int page = DEBUG_PAGE_WEATHER;
+
+/*
+ * Only remembers where the layer goes, it is created the first time it is shown
+ */
 void debug_layer_create(GRect frame, Window *window)
 {
-  debug_layer = text_layer_create(frame);
+  debug_frame = frame;
+  debug_window = window;
+}
+
+static void debug_layer_realize()
+{
+  debug_layer = text_layer_create(debug_frame);
   text_layer_set_text_color(debug_layer, GColorWhite);
   text_layer_set_background_color(debug_layer, GColorClear);
   //text_layer_set_font(debug_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
   text_layer_set_text_alignment(debug_layer, GTextAlignmentRight);
 
-  layer_add_child(window_get_root_layer(window), text_layer_get_layer(debug_layer));
+  layer_add_child(window_get_root_layer(debug_window), text_layer_get_layer(debug_layer));
 }
 
 void debug_enable_display() 
@@ -27,6 +50,9 @@ void debug_enable_display()
   }
 
   is_enabled = true;
+  if (debug_layer == NULL) {
+    debug_layer_realize();
+  }
   layer_set_hidden(text_layer_get_layer(debug_layer), false);
 }
 
@@ -50,13 +76,26 @@ void debug_update_message(char *message)
   text_layer_set_text(debug_layer, debug_msg);
 }
 
+void debug_next_page()
+{
+  page = (page + 1) % (DEBUG_PAGE_METRICS + metrics_page_count());
+}
+
 void debug_update_weather(WeatherData *weather_data)
 {
   if (!is_enabled) {
     return;
   }
 
-  if (weather_data->updated != 0) {
+  if (page == DEBUG_PAGE_LATENCY) {
+    latency_format(debug_msg, sizeof(debug_msg));
+    text_layer_set_text(debug_layer, debug_msg);
+  }
+  else if (page >= DEBUG_PAGE_METRICS) {
+    metrics_format_page(page - DEBUG_PAGE_METRICS, debug_msg, sizeof(debug_msg));
+    text_layer_set_text(debug_layer, debug_msg);
+  }
+  else if (weather_data->updated != 0) {
 
     time_t last_updated = weather_data->updated;
     struct tm *updated_time = localtime(&last_updated);
@@ -74,7 +113,11 @@ void debug_update_weather(WeatherData *weather_data)
 
 void debug_layer_destroy() 
 {
-  text_layer_destroy(debug_layer);
+  if (debug_layer != NULL) {
+    text_layer_destroy(debug_layer);
+    debug_layer = NULL;
+  }
+  is_enabled = false;
 }
 
 
@@ -6,6 +6,7 @@ void debug_enable_display();
 void debug_disable_display();
 void debug_update_message(char *message);
 void debug_update_weather(WeatherData *weather_data);
+void debug_next_page();
 void debug_layer_destroy();
 
 #endif
\ No newline at end of file
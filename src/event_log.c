@@ -0,0 +1,130 @@
+#include <pebble.h>
+#include "network.h"
+#include "config.h"
+#include "event_log.h"
+
+/* Bumped whenever EventLogRecord changes, older persisted logs are discarded */
+#define EVENT_LOG_VERSION 1
+
+/* Entries kept, sized so the record fits in PERSIST_DATA_MAX_LENGTH */
+#define EVENT_LOG_SIZE 30
+
+/* Minutes between writes of a changed log to persistent storage */
+#define EVENT_LOG_PERSIST_INTERVAL 15
+
+/* Bytes per entry when sent to the phone */
+#define EVENT_WIRE_SIZE 8
+
+typedef struct {
+  uint32_t time;
+  uint8_t  id;
+  uint8_t  a;
+  int16_t  b;
+} EventEntry;
+
+typedef struct {
+  uint8_t    version;
+  uint8_t    head;  // next entry to write
+  uint8_t    count;
+  EventEntry entries[EVENT_LOG_SIZE];
+} EventLogRecord;
+
+static EventLogRecord event_log_record;
+static bool event_log_dirty = false;
+static int  minutes_since_persist = 0;
+
+/**
+ * Write the log to persistent storage if it changed
+ */
+static void event_log_persist()
+{
+    if ( !event_log_dirty )
+    {
+        return;
+    }
+    persist_write_data(KEY_EVENT_LOG_RECORD, &event_log_record, sizeof(event_log_record));
+    event_log_dirty = false;
+    minutes_since_persist = 0;
+}
+
+/**
+ * Restore the log of the previous launch, so it can be read after a crash
+ */
+void event_log_init()
+{
+    if ( !persist_exists(KEY_EVENT_LOG_RECORD) ||
+         persist_read_data(KEY_EVENT_LOG_RECORD, &event_log_record,
+                           sizeof(event_log_record)) != (int)sizeof(event_log_record) ||
+         event_log_record.version != EVENT_LOG_VERSION )
+    {
+        memset(&event_log_record, 0, sizeof(event_log_record));
+        event_log_record.version = EVENT_LOG_VERSION;
+    }
+    event_log_dirty = false;
+    minutes_since_persist = 0;
+    event_log(EVENT_INIT, 0, 0);
+}
+
+/**
+ * Persist what changed since the last periodic write
+ */
+void event_log_deinit()
+{
+    event_log(EVENT_DEINIT, 0, 0);
+    event_log_persist();
+}
+
+/**
+ * Record an event with two small arguments, no formatting happens on the watch
+ */
+void event_log( EventId id, uint8_t a, int16_t b )
+{
+    EventEntry *entry = &event_log_record.entries[event_log_record.head];
+    entry->time = time(NULL);
+    entry->id   = id;
+    entry->a    = a;
+    entry->b    = b;
+    
+    event_log_record.head = (event_log_record.head + 1) % EVENT_LOG_SIZE;
+    if ( event_log_record.count < EVENT_LOG_SIZE )
+    {
+        event_log_record.count++;
+    }
+    event_log_dirty = true;
+}
+
+/**
+ * Called on every minute tick, persists the log every EVENT_LOG_PERSIST_INTERVAL minutes
+ */
+void event_log_minute_tick()
+{
+    if ( ++minutes_since_persist >= EVENT_LOG_PERSIST_INTERVAL )
+    {
+        event_log_persist();
+    }
+}
+
+/**
+ * Add the log to a message for the phone, oldest entry first. Each entry is the
+ * time as little endian 32 bit value, the event id, a, and b as little endian 16 bit value.
+ */
+void event_log_write( DictionaryIterator *iter )
+{
+    uint8_t data[EVENT_LOG_SIZE * EVENT_WIRE_SIZE];
+    int first = (event_log_record.head + EVENT_LOG_SIZE - event_log_record.count) % EVENT_LOG_SIZE;
+    
+    for ( int i = 0; i < event_log_record.count; i++ )
+    {
+        EventEntry *entry = &event_log_record.entries[(first + i) % EVENT_LOG_SIZE];
+        uint8_t *out = &data[i * EVENT_WIRE_SIZE];
+        out[0] = entry->time & 0xFF;
+        out[1] = (entry->time >> 8) & 0xFF;
+        out[2] = (entry->time >> 16) & 0xFF;
+        out[3] = (entry->time >> 24) & 0xFF;
+        out[4] = entry->id;
+        out[5] = entry->a;
+        out[6] = (uint16_t)entry->b & 0xFF;
+        out[7] = ((uint16_t)entry->b >> 8) & 0xFF;
+    }
+    dict_write_data(iter, KEY_EVENTS, data, event_log_record.count * EVENT_WIRE_SIZE);
+}
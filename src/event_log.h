@@ -0,0 +1,28 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+/* Logged events, in the order of EVENT_NAMES in pebble-js-app.js. Append only. */
+typedef enum {
+  EVENT_INIT = 0,
+  EVENT_DEINIT,
+  EVENT_JS_READY,
+  EVENT_REQUEST,         // a: retry count, b: request id
+  EVENT_WEATHER,         // a: seq, b: temperature
+  EVENT_WEATHER_DROPPED, // a: seq, b: last applied seq
+  EVENT_CONFIG,          // b: config version
+  EVENT_PHONE_ERROR,
+  EVENT_IN_DROPPED,      // b: AppMessageResult
+  EVENT_OUT_FAILED,      // b: AppMessageResult
+  EVENT_BLUETOOTH,       // a: connected, b: seconds the connection was down
+  EVENT_PERSIST_FAILED,  // a: 0 weather record, 1 settings record, 2 weather locale
+  EVENT_POWER_MODE,      // a: PowerMode, b: battery charge percent
+  EVENT_STARTUP          // a: heap used in KB once started, b: ms until the event loop started
+} EventId;
+
+void event_log_init();
+void event_log_deinit();
+void event_log( EventId id, uint8_t a, int16_t b );
+void event_log_minute_tick();
+void event_log_write( DictionaryIterator *iter );
+
+#endif
@@ -11,26 +11,100 @@
 var SERVICE_OPEN_WEATHER  = "open";
 var SERVICE_YAHOO_WEATHER = "yahoo";
 var SERVICE_WUNDER_WEATHER = "wunder";
+var SERVICE_AGGREGATOR    = "aggregator";
 var EXTERNAL_DEBUG_URL    = '';
 //var CONFIGURATION_URL     = 'http://jaredbiehler.github.io/weather-my-way/config/';
 var CONFIGURATION_URL     = 'http://192.168.0.7/config/';
-var EARTH_RADIUS          = 63781370; // Meters
+var EARTH_RADIUS          = 6371000; // Meters, mean radius
+
+/* Outbound message types, in priority order */
+var MSG_CONFIG            = 'config';
+var MSG_CONTROL           = 'control';
+var MSG_WEATHER           = 'weather';
+var MSG_PRIORITY          = { config: 0, control: 1, weather: 2 };
+var CONFIG_FORMAT         = 1; // must match CONFIG_FORMAT in network.h
+
+/* Circuit breaker states */
+var BREAKER_CLOSED        = 'closed';
+var BREAKER_OPEN          = 'open';
+var BREAKER_HALF_OPEN     = 'half-open';
+
+/* Weather fields in KEY_CHANGED bit order, must match WeatherField in network.h */
+var WEATHER_FIELDS = [
+    'temperature', 'condition', 'sunrise', 'sunset', 'pubdate', 'tzoffset', 'locale',
+    'h1_temp', 'h1_cond', 'h1_time', 'h1_pop', 'h2_temp', 'h2_cond', 'h2_time', 'h2_pop',
+    'provider'
+];
+
+/* Phone side stages of a pebble request, must match LatencyStage in latency.h */
+var TRACE_STAGES = [ 'wait', 'fetch', 'parse', 'queue' ];
+
+/* Pebble metrics in the order they are dumped, must match Metric in metrics.h */
+var METRIC_NAMES = [
+    'requests', 'retries', 'drops', 'redraws', 'wakeups', 'bytes_in',
+    'fail_timeout', 'fail_rejected', 'fail_not_connected', 'fail_busy', 'fail_other',
+    'heap_peak', 'bt_flaps', 'merged', 'request_timeouts',
+    'sniff_reduced_ms'
+];
+
+/* Pebble event log ids, must match EventId in event_log.h */
+var EVENT_NAMES = [
+    'init', 'deinit', 'js_ready', 'request', 'weather', 'weather_dropped', 'config',
+    'phone_error', 'in_dropped', 'out_failed', 'bluetooth', 'persist_failed', 'power_mode',
+    'startup'
+];
+
+/* Log levels, most severe first */
+var LOG_ERROR             = 0;
+var LOG_WARN              = 1;
+var LOG_INFO              = 2;
+var LOG_DEBUG             = 3;
 
 /**
  * The global configuration.
  */
 var Global = {
     externalDebug:     false, // POST logs to external server - dangerous! lat lon recorded
+    debugUpload: {
+        maxBytes:       4096, // post the batch once this much is queued
+        maxDelay:       60 * 1000 // 1 minute in ms, longest a message waits to be posted
+    },
+    logLevel:          LOG_ERROR, // most verbose level logged when debug is off
+    logSampling: {
+        outbox:         0.1 // fraction of the per message outbox chatter which is logged
+    },
     wuApiKey:          null, // register for a free api key!
+    aggregatorUrl:     null, // self hosted endpoint serving normalized weather per cell
     hourlyIndex1:      2, // 3 Hours from now 
     hourlyIndex2:      8, // 9 hours from now
+    hourlyWanted:      true, // the pebble leaves out the hourly forecast to save power
     updateInProgress:  false,
     updateWaitTimeout: 5 * 60 * 1000, // 5 minutes in ms
     lastUpdateAttempt: new Date(),
-    weatherDataLat:    0,
-    weatherDataLong:   0,
+    weatherDataLat:    null, // center of the cell the current weather was fetched for
+    weatherDataLong:   null,
+    geofenceRadius:    3000, // meters, leaving the cell triggers a refetch
+    cellSize:          0.02, // degrees, grid used to cache place lookups (~2km)
+    maxCachedPlaces:   20,
+    lastFix:           null, // { lat, lon, time } of the last coarse position fix
+    locationOptions: {
+        enableHighAccuracy: false, // network location is plenty for weather
+        timeout:            30000,
+        maximumAge:         15 * 60 * 1000 // 15 minutes in ms, accept cached fixes
+    },
     maxRetry:          3,
     retryWait:         1000, // ms
+    ackTimeout:        10000, // ms, an unanswered message is treated as a NACK
+    fetchTimeout:      20000, // ms, a provider without a response by then has failed
+    httpCache:         {}, // url -> { etag, lastModified, response }
+    httpCacheMax:      4,
+    lastAckedHash:     null, // hash of the last weather record the pebble acknowledged
+    lastAckedTime:     0,
+    maxSuppressAge:    60 * 60 * 1000, // resend unchanged data after 1 hour in ms
+    notModifiedCount:  0,
+    suppressedSends:   0,
+    weatherSeq:        0, // sequence number of the last weather update built
+    ackedWeather:      {}, // weather fields the pebble acknowledged
     config: {
         debugEnabled:   false,
         batteryEnabled: true,
@@ -38,23 +112,83 @@ var Global = {
         weatherScale:   'F',
         homeWeatherLat: 41.739841,
         homeWeatherLong: -93.620774,
-        homeZip:        50023
+        homeZip:        50023,
+        trackLocation:  true, // fall back to the home location when false or unavailable
+        hedgeEnabled:   false, // also ask a secondary provider when the first one is slow
+        quietStart:     23, // local hour quiet hours begin, Weather Underground is asked less
+        quietEnd:       6 // local hour quiet hours end
     },
+    wuQuota: {
+        dailyLimit:     500, // calls per day allowed for a free api key
+        reserve:        50, // calls kept for refreshes the user asked for
+        burst:          5, // calls which can be made back to back
+        quietInterval:  2 * 60 * 60 * 1000 // 2 hours in ms between calls in quiet hours
+    },
+    userRefresh:       false, // the pending update was asked for by the user
+    publishPeriod:     30 * 60 * 1000, // 30 minutes in ms, until a provider's period is learned
+    publishMargin:     5 * 60 * 1000, // 5 minutes in ms, initial wait after an expected publish
+    minFetchInterval:  15 * 60 * 1000, // 15 minutes in ms
+    maxFetchInterval:  2 * 60 * 60 * 1000, // 2 hours in ms
+    fetchSpread:       10 * 60 * 1000, // 10 minutes in ms, window the fleet's fetches spread over
+    nextFetch:         0, // ms, suggested time of the next fetch
+    ackedNextFetch:    0, // ms, suggested time the pebble acknowledged
+    cachedWeather:     null, // { weather, fetched, nextFetch, lat, lon } persisted across restarts
+    maxCachedAge:      24 * 60 * 60 * 1000, // 24 hours in ms, older records are not restored
+    warmStart:         false, // the cached record was queued for the pebble, its first request may be skipped
+    hedgeDelay:        3000, // ms to wait for the primary provider before hedging
+    breakers:          {}, // service -> { failures, openedAt, trial }
+    breakerThreshold:  3, // consecutive failures which open a provider's breaker
+    breakerCooldown:   10 * 60 * 1000, // 10 minutes in ms before a provider is tried again
+    timeToWeather:     { hedged: [], single: [] }, // ms, most recent samples
+    trace:             null, // stage times of the pending pebble request, see traceStage
+    stageSamples:      { wait: [], fetch: [], parse: [], queue: [] }, // ms, most recent samples
+    maxLatencySamples: 50,
     locationWatchingId:    0
 };
 
-/** Allow console messages to be turned on / off */
-(function(){
-    var original = console.log;
-    var logMessage = function (message) {
-        if (Global.config.debugEnabled)
-        {
-          original.apply(console, arguments);
-        }  
-    };
-    console.log  = logMessage;
-    console.warn = logMessage;
-})();
+/**
+ * Most verbose level which is logged, everything when debugging
+ */
+var logLevel = function()
+{
+    return Global.config.debugEnabled ? LOG_DEBUG : Global.logLevel;
+};
+
+/**
+ * Check if messages of a level are logged, for callers with more work than a thunk
+ *
+ * @param level LOG_ERROR, LOG_WARN, LOG_INFO or LOG_DEBUG
+ */
+var isLogged = function(level)
+{
+    return level <= logLevel();
+};
+
+/**
+ * Log a message. The message can be a function returning it, which is only called
+ * when the message is logged, so filtered messages cost nothing to build.
+ *
+ * @param level      LOG_ERROR, LOG_WARN, LOG_INFO or LOG_DEBUG
+ * @param message    String, or function returning the string
+ * @param sampleRate Optional fraction of the messages which are logged
+ */
+var log = function(level, message, sampleRate)
+{
+    if (!isLogged(level) || (sampleRate !== undefined && Math.random() >= sampleRate)) {
+        return;
+    }
+    var text = (typeof message === 'function') ? message() : message;
+    if (level <= LOG_WARN) {
+        console.warn(text);
+    } else {
+        console.log(text);
+    }
+};
+
+var logError = function(message, sampleRate) { log(LOG_ERROR, message, sampleRate); };
+var logWarn  = function(message, sampleRate) { log(LOG_WARN,  message, sampleRate); };
+var logInfo  = function(message, sampleRate) { log(LOG_INFO,  message, sampleRate); };
+var logDebug = function(message, sampleRate) { log(LOG_DEBUG, message, sampleRate); };
 
 /**
  * Post an XmlHttpRequest with data to the the supplied url
@@ -72,168 +206,1084 @@ var post = function(url, data)
     }
     catch(ex)
     {
-        console.warn('POST failed: ' + ex.message);
+        logWarn(function(){ return 'POST failed: ' + ex.message; });
     }
 };
 
 /**
- * Post the supplied debug messages to the external debug url
+ * Debug messages waiting to be posted to the external debug url
+ */
+var DebugUpload = {
+    batch:  [], // JSON strings of { time, data }
+    bytes:  0,
+    timer:  null
+};
+
+/**
+ * Post the batched debug messages to the external debug url as one JSON array
+ */
+var flushDebugMessages = function ()
+{
+    clearTimeout(DebugUpload.timer);
+    DebugUpload.timer = null;
+    if (DebugUpload.batch.length === 0) {
+        return;
+    }
+    var body = 'data=' + encodeURIComponent('[' + DebugUpload.batch.join(',') + ']');
+    DebugUpload.batch = [];
+    DebugUpload.bytes = 0;
+    post(EXTERNAL_DEBUG_URL, body);
+};
+
+/**
+ * Queue a debug message for the external debug url. Messages are posted in batches,
+ * once Global.debugUpload.maxBytes are queued or the oldest is
+ * Global.debugUpload.maxDelay old.
+ *
+ * @param data Object describing the event
  */
 var postDebugMessage = function (data)
 {
-    if (!Global.externalDebug || EXTERNAL_DEBUG_URL === null) {
+    if (!Global.externalDebug || !EXTERNAL_DEBUG_URL) {
         return;
     }
     try {
-        post(EXTERNAL_DEBUG_URL, 'data='+JSON.stringify(data));
+        var entry = JSON.stringify({ time: new Date().getTime(), data: data });
+        DebugUpload.batch.push(entry);
+        DebugUpload.bytes += entry.length;
+        if (DebugUpload.bytes >= Global.debugUpload.maxBytes) {
+            flushDebugMessages();
+        } else if (DebugUpload.timer === null) {
+            DebugUpload.timer = setTimeout(flushDebugMessages, Global.debugUpload.maxDelay);
+        }
     } catch (ex) {
-        console.warn('Post Debug Message failed:'+ex.message);
+        logWarn(function(){ return 'Post Debug Message failed:'+ex.message; });
     }
 };
 
 
+/**
+ * Outbound AppMessage queue. Only one message is in flight at a time, newer
+ * config and weather messages replace older unsent ones of the same type, and
+ * config messages are sent ahead of everything else.
+ */
+var Outbox = {
+    queue:      [],
+    inFlight:   null,
+    sentAt:     0,
+    timer:      null,
+    maxDepth:   0,
+    latencies:  [], // ms, most recent ack latencies
+    maxSamples: 20
+};
+
+/**
+ * Insert a message into the queue behind every message of equal or higher priority,
+ * or in front of them if it is being retried
+ *
+ * @param msg   The queued message
+ * @param retry True if the message already waited its turn once
+ */
+var insertMessage = function (msg, retry)
+{
+    var i = 0;
+    var priority = MSG_PRIORITY[msg.type];
+    while (i < Outbox.queue.length &&
+           (MSG_PRIORITY[Outbox.queue[i].type] < priority ||
+            (!retry && MSG_PRIORITY[Outbox.queue[i].type] === priority))) {
+        i++;
+    }
+    Outbox.queue.splice(i, 0, msg);
+    Outbox.maxDepth = Math.max(Outbox.maxDepth, Outbox.queue.length);
+};
+
+/**
+ * Find the unsent message of the given type, config and weather messages only
+ * ever have one queued
+ *
+ * @param type The message type
+ */
+var findQueuedMessage = function (type)
+{
+    for (var i = 0; i < Outbox.queue.length; i++) {
+        if (Outbox.queue[i].type === type) {
+            return i;
+        }
+    }
+    return -1;
+};
+
+/**
+ * Queue a message for the pebble
+ *
+ * @param type  MSG_CONFIG, MSG_CONTROL or MSG_WEATHER
+ * @param data  The AppMessage dictionary, or a function building it when sent
+ * @param onAck Optional callback once the pebble acknowledged the message
+ */
+var sendMessage = function (type, data, onAck)
+{
+    var msg = { type: type, data: data, onAck: onAck, retry: 0 };
+    var queued = (type === MSG_CONTROL) ? -1 : findQueuedMessage(type);
+    if (queued >= 0) {
+        logDebug(function(){ return "Outbox replacing unsent " + type + " message"; });
+        Outbox.queue[queued] = msg;
+    } else {
+        insertMessage(msg, false);
+    }
+    logDebug(function(){ return "Outbox depth: " + Outbox.queue.length + " max: " + Outbox.maxDepth; },
+             Global.logSampling.outbox);
+    pumpOutbox();
+};
+
+/**
+ * Send the next queued message, unless one is already in flight or waiting to retry
+ */
+var pumpOutbox = function ()
+{
+    if (Outbox.inFlight || Outbox.timer || Outbox.queue.length === 0) {
+        return;
+    }
+    var msg = Outbox.queue.shift();
+    // weather updates are built when sent, relative to what was acknowledged by then
+    msg.payload     = (typeof msg.data === 'function') ? msg.data() : msg.data;
+    Outbox.inFlight = msg;
+    Outbox.sentAt   = new Date().getTime();
+    Outbox.timer    = setTimeout(function(){ nack(msg); }, Global.ackTimeout);
+    Pebble.sendAppMessage(msg.payload, function(e){ ack(msg); }, function(e){ nack(msg); });
+};
+
 /**
  * The pebble acknowledgement that the sent message was received and handled
+ *
+ * @param msg The in flight message
+ */
+var ack  = function (msg)
+{
+    if (Outbox.inFlight !== msg) {
+        return;
+    }
+    var latency = new Date().getTime() - Outbox.sentAt;
+    Outbox.latencies.push(latency);
+    if (Outbox.latencies.length > Outbox.maxSamples) {
+        Outbox.latencies.shift();
+    }
+    logDebug(function(){ return "Pebble ACK sendAppMessage latency:" + latency + "ms avg:" +
+                                Math.round(Outbox.latencies.reduce(function(a, b){ return a + b; }, 0) /
+                                           Outbox.latencies.length) + "ms"; },
+             Global.logSampling.outbox);
+
+    clearTimeout(Outbox.timer);
+    Outbox.timer    = null;
+    Outbox.inFlight = null;
+    if (msg.onAck) {
+        msg.onAck();
+    }
+    pumpOutbox();
+};
+
+/**
+ * The pebble did not acknowledge the message was received. The message is retried
+ * after Global.retryWait unless a newer message of the same type replaced it.
+ *
+ * @param msg The in flight message
  */
-var ack  = function ()
+var nack = function (msg)
 {
-    console.log("Pebble ACK sendAppMessage");
+    if (Outbox.inFlight !== msg) {
+        return;
+    }
+    clearTimeout(Outbox.timer);
+    Outbox.inFlight = null;
+
+    msg.retry++;
+    if (msg.retry >= Global.maxRetry) {
+        logError(function(){ return "Pebble NACK sendAppMessage max exceeded, dropped " + msg.type + " message"; });
+    } else if (msg.type !== MSG_CONTROL && findQueuedMessage(msg.type) >= 0) {
+        logDebug(function(){ return "Pebble NACK sendAppMessage superseded by newer " + msg.type + " message"; });
+    } else {
+        logWarn(function(){ return "Pebble NACK sendAppMessage retryCount:"+msg.retry+" data:"+JSON.stringify(msg.payload); });
+        insertMessage(msg, true);
+    }
+    Outbox.timer = setTimeout(function(){
+                              Outbox.timer = null;
+                              pumpOutbox();
+                              }, Global.retryWait);
 };
 
 /**
- * The pebble did not acknowledget the message was received
+ * Remember the validators of a response so the next request for the url can be
+ * made conditional. Oldest entries are dropped once Global.httpCacheMax is reached.
+ *
+ * @param url       The url the response was received for
+ * @param req       The completed XMLHttpRequest
+ * @param response  The parsed response body
  */
-var nack = function (data, retry)
+var storeValidators = function(url, req, response)
 {
-    retry = typeof retry !== 'undefined' ? retry : 0;
-    retry++;
-    if (retry >= Global.maxRetry) {
-        console.warn("Pebble NACK sendAppMessage max exceeded");
+    var etag         = req.getResponseHeader('ETag');
+    var lastModified = req.getResponseHeader('Last-Modified');
+    if (!etag && !lastModified) {
+        delete Global.httpCache[url];
         return;
     }
-    console.warn("Pebble NACK sendAppMessage retryCount:"+retry+" data:"+JSON.stringify(data));
-    if (data)
-    {
-        setTimeout(function(){
-               Pebble.sendAppMessage(data, ack, function(e){ nack(data, retry); });
-           }, Global.retryWait + Math.floor(Math.random() * Global.retryWait));
+    var urls = Object.keys(Global.httpCache);
+    if (!Global.httpCache.hasOwnProperty(url) && urls.length >= Global.httpCacheMax) {
+        delete Global.httpCache[urls[0]];
     }
+    Global.httpCache[url] = {
+        etag:         etag,
+        lastModified: lastModified,
+        response:     response
+    };
 };
 
 /**
- * Create, request and handle the JSON formatted response 
+ * Create, request and handle the JSON formatted response. If a previous response
+ * for the url carried an ETag or Last-Modified header the request is made conditional,
+ * and a 304 answer hands the previously parsed response back to the callback.
  *
  * @param url       The complete url we will use for the request
- * @param callback  The callback which will be executed at completion
+ * @param callback  The callback which will be executed at completion, with an error
+ *                  when there is no response within Global.fetchTimeout
+ * @return The XMLHttpRequest, or null if it could not be sent
  */
 var getJson = function(url, callback)
 {
+    // a request without an answer would keep the pebble's request waiting
+    var finished = false;
+    var timer    = null;
+    var done = function(err, response) {
+        if (finished) {
+            return;
+        }
+        finished = true;
+        clearTimeout(timer);
+        callback(err, response);
+    };
+    try {
+        var cached = Global.httpCache[url];
+        var req = new XMLHttpRequest();
+        req.open('GET', url, true);
+        if (cached) {
+            if (cached.etag) {
+                req.setRequestHeader('If-None-Match', cached.etag);
+            }
+            if (cached.lastModified) {
+                req.setRequestHeader('If-Modified-Since', cached.lastModified);
+            }
+        }
+        req.onload = function(e) {
+            if (req.readyState == 4) {
+                if (req.status == 304 && cached) {
+                    Global.notModifiedCount++;
+                    logDebug(function(){ return "HTTP 304 Not Modified, count: " + Global.notModifiedCount; });
+                    done(null, cached.response);
+                } else if(req.status == 200) {
+                    try {
+                        //console.log(req.responseText);
+                        var response = JSON.parse(req.responseText);
+                        storeValidators(url, req, response);
+                        done(null, response);
+                    } catch (ex) {
+                        done(ex.message);
+                    }
+                } else {
+                    done("Error request status not 200, status: "+req.status);
+                }
+            }
+        };
+        req.send(null);
+        timer = setTimeout(function() {
+            req.abort();
+            done("No response in " + Global.fetchTimeout + "ms");
+        }, Global.fetchTimeout);
+        return req;
+    } catch(ex) {
+        done("Unable to GET JSON: "+ex.message);
+        return null;
+    }
+};
+
+/**
+ * Compute a 32 bit hash of a string
+ *
+ * @param str The string to hash
+ */
+var hashString = function(str)
+{
+    var hash = 0;
+    for (var i = 0; i < str.length; i++) {
+        hash = ((hash << 5) - hash + str.charCodeAt(i)) | 0;
+    }
+    return hash;
+};
+
+/**
+ * Compute a 32 bit hash of the normalized weather record
+ *
+ * @param weather The normalized weather record which is sent to the pebble
+ */
+var hashWeather = function(weather)
+{
+    return hashString(JSON.stringify(weather));
+};
+
+/**
+ * Check if the weather record matches what the pebble last acknowledged. The
+ * record is still resent after Global.maxSuppressAge so the watch does not
+ * consider its data stale.
+ *
+ * @param hash Hash of the normalized weather record
+ */
+var isWeatherUnchanged = function(hash)
+{
+    return hash === Global.lastAckedHash &&
+        new Date().getTime() - Global.lastAckedTime < Global.maxSuppressAge;
+};
+
+/**
+ * Build a weather update holding only the fields which differ from what the pebble
+ * last acknowledged, plus a sequence number, the mask of the changed fields and
+ * the suggested time of the next fetch
+ *
+ * @param weather The normalized weather record
+ */
+var buildWeatherUpdate = function(weather)
+{
+    var update = {}, changed = 0;
+    WEATHER_FIELDS.forEach(function(field, bit) {
+        if (weather.hasOwnProperty(field) && weather[field] !== Global.ackedWeather[field]) {
+            update[field] = weather[field];
+            changed |= (1 << bit);
+        }
+    });
+    update.seq     = ++Global.weatherSeq;
+    update.changed = changed;
+    if (Global.nextFetch > 0) {
+        update.next_fetch = toPebbleTime(Global.nextFetch);
+    }
+    return update;
+};
+
+/**
+ * Record the fields of a weather record the pebble acknowledged
+ *
+ * @param weather The normalized weather record
+ */
+var ackWeatherUpdate = function(weather)
+{
+    WEATHER_FIELDS.forEach(function(field) {
+        if (weather.hasOwnProperty(field)) {
+            Global.ackedWeather[field] = weather[field];
+        }
+    });
+};
+
+/**
+ * Estimated publish period of a provider, the median of the observed intervals
+ *
+ * @param cadence The provider's entry of the persisted cadence
+ */
+var publishPeriod = function(cadence)
+{
+    if (cadence.intervals.length === 0) {
+        return Global.publishPeriod;
+    }
+    var period = percentile(cadence.intervals, 0.5);
+    return Math.max(60000, Math.round(period / 60000) * 60000);
+};
+
+/**
+ * Stable per device offset within Global.fetchSpread, so devices watching the same
+ * provider do not all fetch in the same minute. Derived from the account token,
+ * or a random value kept in localStorage when there is none.
+ */
+var fetchOffset = function()
+{
+    var identity = null;
+    try {
+        identity = Pebble.getAccountToken();
+    } catch (ex) {
+        identity = null;
+    }
+    if (!identity) {
+        identity = localStorage.getItem('deviceId');
+        if (identity === null) {
+            identity = String(Math.random()).slice(2);
+            localStorage.setItem('deviceId', identity);
+        }
+    }
+    var spread = Math.round(Global.fetchSpread / 1000);
+    return (((hashString(identity) % spread) + spread) % spread) * 1000;
+};
+
+/**
+ * First expected publish of a provider, plus the learned margin and the device's
+ * fetch offset, which is at least Global.minFetchInterval away
+ *
+ * @param cadence The provider's entry of the persisted cadence
+ * @param now     Current time in ms
+ */
+var nextPublishFetch = function(cadence, now)
+{
+    var period   = publishPeriod(cadence);
+    var earliest = now + Global.minFetchInterval;
+    if (cadence.last === 0) {
+        return now + period + fetchOffset();
+    }
+    var next = cadence.last + cadence.margin + fetchOffset();
+    if (next < earliest) {
+        next += Math.ceil((earliest - next) / period) * period;
+    }
+    return Math.min(next, now + Global.maxFetchInterval);
+};
+
+/**
+ * Learn when a provider publishes from the observation times of its records. New
+ * observations give the publish period, and a fetch at the suggested time which
+ * found nothing new pushes the margin after the expected publish out.
+ *
+ * @param service  The provider
+ * @param observed Observation time of the record in ms
+ * @return The suggested time of the next fetch in ms
+ */
+var observePublish = function(service, observed)
+{
+    var all;
+    try {
+        all = JSON.parse(localStorage.getItem('cadence')) || {};
+    } catch (ex) {
+        all = {};
+    }
+    var now     = new Date().getTime();
+    var cadence = all[service] || { last: 0, intervals: [], margin: Global.publishMargin, suggested: 0 };
+    
+    if (observed > cadence.last) {
+        var interval = observed - cadence.last;
+        if (cadence.last > 0 && interval >= 5 * 60 * 1000 && interval <= 6 * 60 * 60 * 1000) {
+            cadence.intervals.push(interval);
+            if (cadence.intervals.length > 8) {
+                cadence.intervals.shift();
+            }
+        }
+        cadence.last   = observed;
+        cadence.margin = Math.max(60000, cadence.margin - 30000);
+    } else if (cadence.suggested > 0 && now >= cadence.suggested) {
+        // we fetched when suggested and the provider had not published yet
+        cadence.margin = Math.min(publishPeriod(cadence) / 2, cadence.margin + 2 * 60000);
+    }
+    cadence.suggested = nextPublishFetch(cadence, now);
+    all[service] = cadence;
+    localStorage.setItem('cadence', JSON.stringify(all));
+    
+    logDebug(function(){ return "Publish cadence " + service + ": period " + publishPeriod(cadence) / 60000 +
+                                "min margin " + cadence.margin / 60000 + "min next fetch in " +
+                                Math.round((cadence.suggested - now) / 60000) + "min"; });
+    return cadence.suggested;
+};
+
+/**
+ * Convert a time in ms into seconds on the pebble's clock, which runs on local time
+ *
+ * @param ms Time in ms since the epoch
+ */
+var toPebbleTime = function(ms)
+{
+    return Math.round(ms / 1000) - new Date(ms).getTimezoneOffset() * 60;
+};
+
+/**
+ * Restore the configuration persisted by storeConfig
+ */
+var loadConfig = function()
+{
+    try {
+        var config = JSON.parse(localStorage.getItem('config'));
+        if (config) {
+            Object.keys(Global.config).forEach(function(key) {
+                if (config.hasOwnProperty(key)) {
+                    Global.config[key] = config[key];
+                }
+            });
+        }
+    } catch (ex) {
+        logWarn(function(){ return "Unable to restore the configuration: " + ex.message; });
+    }
+};
+
+/**
+ * Persist Global.config, so a restarted javascript context knows the pebble's
+ * configuration without another handshake
+ */
+var storeConfig = function()
+{
+    localStorage.setItem('config', JSON.stringify(Global.config));
+};
+
+/**
+ * Restore the last normalized weather record persisted by deliverWeather
+ */
+var loadCachedWeather = function()
+{
+    try {
+        var cached = JSON.parse(localStorage.getItem('lastWeather'));
+        if (cached && new Date().getTime() - cached.fetched < Global.maxCachedAge) {
+            return cached;
+        }
+    } catch (ex) {
+        logWarn(function(){ return "Unable to restore the cached weather: " + ex.message; });
+    }
+    return null;
+};
+
+/**
+ * Persist the last normalized weather record with the position it was fetched for,
+ * so the location watch of a restarted context knows the current cell
+ *
+ * @param weather   The normalized weather record
+ * @param nextFetch Suggested time of the next fetch in ms
+ */
+var storeCachedWeather = function(weather, nextFetch)
+{
+    Global.cachedWeather = { weather: weather, fetched: new Date().getTime(), nextFetch: nextFetch,
+                             lat: Global.weatherDataLat, lon: Global.weatherDataLong };
+    localStorage.setItem('lastWeather', JSON.stringify(Global.cachedWeather));
+};
+
+/**
+ * Check if the cached weather record is recent enough that the pebble does not
+ * need a fetch yet
+ */
+var isCachedWeatherFresh = function()
+{
+    var cached = Global.cachedWeather;
+    if (cached === null) {
+        return false;
+    }
+    var now = new Date().getTime();
+    return cached.nextFetch > 0 ? now < cached.nextFetch :
+        now - cached.fetched < Global.minFetchInterval;
+};
+
+/**
+ * Send the cached weather record to the pebble right away, marked with its age so
+ * the pebble knows when it was actually fetched
+ */
+var pushCachedWeather = function()
+{
+    var cached = Global.cachedWeather;
+    var hash   = hashWeather(cached.weather);
+    Global.nextFetch = cached.nextFetch;
+    logDebug(function(){ return "Restoring weather fetched " +
+                                Math.round((new Date().getTime() - cached.fetched) / 60000) + " minutes ago"; });
+    // set when queued, the pebble's first request usually arrives before the ack and
+    // the outbox keeps retrying the record until the pebble has it
+    Global.warmStart = true;
+    sendMessage(MSG_WEATHER, function(){
+                var update = buildWeatherUpdate(cached.weather);
+                update.age = Math.round((new Date().getTime() - cached.fetched) / 1000);
+                return update;
+                },
+                function(){
+                ackWeatherUpdate(cached.weather);
+                // unchanged data is resent once the record is Global.maxSuppressAge old
+                Global.lastAckedHash  = hash;
+                Global.lastAckedTime  = cached.fetched;
+                Global.ackedNextFetch = cached.nextFetch;
+                });
+};
+
+/**
+ * Send a normalized weather record to the pebble, unless it already has it
+ *
+ * @param weather The normalized weather record
+ * @param service The service queried for it, its publish cadence is learned
+ */
+var deliverWeather = function(weather, service)
+{
+    var hash = hashWeather(weather);
+    logDebug(function(){ return 'Weather Data: ' + JSON.stringify(weather); });
+    
+    // the aggregator refreshes on its own schedule, whichever provider it serves
+    var nextFetch = observePublish(service, weather.observed);
+    Global.nextFetch = nextFetch;
+    storeCachedWeather(weather, nextFetch);
+    
+    if (isWeatherUnchanged(hash)) {
+        Global.suppressedSends++;
+        logDebug(function(){ return 'Weather unchanged, suppressed sends: ' + Global.suppressedSends; });
+        // the pebble still has to learn when to ask again, and how long its request took
+        if (nextFetch !== Global.ackedNextFetch || Global.trace !== null) {
+            sendMessage(MSG_CONTROL, function(){
+                        return withTrace({ "next_fetch": toPebbleTime(nextFetch) });
+                        },
+                        function(){
+                        Global.ackedNextFetch = nextFetch;
+                        });
+        }
+        return;
+    }
+    sendMessage(MSG_WEATHER, function(){ return withTrace(buildWeatherUpdate(weather)); },
+                function(){
+                ackWeatherUpdate(weather);
+                Global.lastAckedHash  = hash;
+                Global.lastAckedTime  = new Date().getTime();
+                Global.ackedNextFetch = nextFetch;
+                });
+    postDebugMessage(weather);
+};
+
+/**
+ * Tell the pebble no weather could be retrieved, which also completes its request
+ *
+ * @param message Optional error for the pebble's log, "HTTP Error" by default
+ */
+var deliverError = function(message)
+{
+    var error = { "error": message || "HTTP Error" };
+    logError(function(){ return "No weather, sending the pebble an error: " + error.error; });
+    // the next good record must be sent to clear the error on the pebble
+    Global.lastAckedHash = null;
+    sendMessage(MSG_WEATHER, function(){ return withTrace({ "error": error.error }); });
+    postDebugMessage(error);
+};
+
+/**
+ * Value below which the fraction p of the samples fall
+ *
+ * @param samples Array of numbers
+ * @param p       Fraction between 0 and 1
+ */
+var percentile = function(samples, p)
+{
+    var sorted = samples.slice().sort(function(a, b) { return a - b; });
+    return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+};
+
+/**
+ * Record how long it took from starting a fetch to having a valid weather record
+ *
+ * @param hedged True if a secondary provider was allowed to race the primary
+ * @param ms     Time to weather in ms
+ */
+var recordTimeToWeather = function(hedged, ms)
+{
+    var samples = hedged ? Global.timeToWeather.hedged : Global.timeToWeather.single;
+    samples.push(ms);
+    if (samples.length > Global.maxLatencySamples) {
+        samples.shift();
+    }
+    logDebug(function(){ return "Time to weather (" + (hedged ? "hedged" : "single") + "): " + ms + "ms" +
+                                " p50:" + percentile(samples, 0.5) + "ms p99:" + percentile(samples, 0.99) +
+                                "ms n:" + samples.length; });
+};
+
+/**
+ * Start tracing a pebble weather request
+ *
+ * @param reqId Request id sent by the pebble
+ */
+var traceRequest = function(reqId)
+{
+    Global.trace = { reqId: reqId, recv: new Date().getTime() };
+};
+
+/**
+ * Record when the pending pebble request reached a stage, the first time counts
+ *
+ * @param stage fetchStart, fetchEnd or parsed
+ * @param time  Time in ms, now if omitted
+ */
+var traceStage = function(stage, time)
+{
+    if (Global.trace !== null && !Global.trace.hasOwnProperty(stage)) {
+        Global.trace[stage] = time || new Date().getTime();
+    }
+};
+
+/**
+ * Close the trace of the pending pebble request as it is sent. Returns the request id
+ * and the duration of each stage in ms as little endian 16 bit values, in the order
+ * of LatencyStage in latency.h, or null when no request is pending.
+ */
+var takeTrace = function()
+{
+    var trace = Global.trace;
+    if (trace === null) {
+        return null;
+    }
+    Global.trace = null;
+    
+    var now       = new Date().getTime();
+    var fetchStart = trace.fetchStart || now;
+    var fetchEnd   = trace.fetchEnd   || fetchStart;
+    var parsed     = trace.parsed     || fetchEnd;
+    var durations  = {
+        wait:  fetchStart - trace.recv,
+        fetch: fetchEnd - fetchStart,
+        parse: parsed - fetchEnd,
+        queue: now - parsed
+    };
+    var stages = [];
+    TRACE_STAGES.forEach(function(stage) {
+        var ms = Math.max(0, Math.min(0xFFFF, durations[stage]));
+        stages.push(ms & 0xFF, ms >> 8);
+        
+        var samples = Global.stageSamples[stage];
+        samples.push(ms);
+        if (samples.length > Global.maxLatencySamples) {
+            samples.shift();
+        }
+    });
+    logDebug(function(){
+        return "Request " + trace.reqId + " stages " + TRACE_STAGES.map(function(stage) {
+            var samples = Global.stageSamples[stage];
+            return stage + ":" + durations[stage] + "ms (p50:" + percentile(samples, 0.5) +
+                " p99:" + percentile(samples, 0.99) + ")";
+        }).join(" ");
+    });
+    return { "req_id": trace.reqId, "stages": stages };
+};
+
+/**
+ * Add the closed trace of the pending pebble request to a message
+ *
+ * @param payload The AppMessage dictionary
+ */
+var withTrace = function(payload)
+{
+    var trace = takeTrace();
+    if (trace !== null) {
+        payload.req_id = trace.req_id;
+        payload.stages = trace.stages;
+    }
+    return payload;
+};
+
+/**
+ * State of a provider's circuit breaker. An open breaker turns half-open once
+ * Global.breakerCooldown has passed, letting a single request through as a trial.
+ * It stays open for everyone else until that trial is resolved.
+ *
+ * @param service The provider
+ */
+var breakerState = function(service)
+{
+    var breaker = Global.breakers[service];
+    if (!breaker || breaker.openedAt === 0) {
+        return BREAKER_CLOSED;
+    }
+    return (breaker.trial || new Date().getTime() - breaker.openedAt < Global.breakerCooldown) ?
+        BREAKER_OPEN : BREAKER_HALF_OPEN;
+};
+
+/**
+ * A request to a provider starts, the trial if its breaker is half-open
+ *
+ * @param service The provider
+ */
+var breakerStart = function(service)
+{
+    if (breakerState(service) === BREAKER_HALF_OPEN) {
+        logDebug(function(){ return "Circuit breaker trial: " + service; });
+        Global.breakers[service].trial = true;
+    }
+};
+
+/**
+ * A request to a provider was abandoned without an answer, a trial is left to the
+ * next request
+ *
+ * @param service The provider
+ */
+var breakerAbandon = function(service)
+{
+    var breaker = Global.breakers[service];
+    if (breaker) {
+        breaker.trial = false;
+    }
+};
+
+/**
+ * Record a good answer from a provider, closing its breaker
+ *
+ * @param service The provider
+ */
+var breakerSuccess = function(service)
+{
+    if (breakerState(service) !== BREAKER_CLOSED) {
+        logDebug(function(){ return "Circuit breaker closed: " + service; });
+    }
+    Global.breakers[service] = { failures: 0, openedAt: 0, trial: false };
+};
+
+/**
+ * Record a failed request to a provider. The breaker opens after
+ * Global.breakerThreshold failures in a row, or when a half-open trial fails.
+ *
+ * @param service The provider
+ */
+var breakerFailure = function(service)
+{
+    var breaker = Global.breakers[service] || { failures: 0, openedAt: 0, trial: false };
+    breaker.failures++;
+    if (breaker.trial || breaker.failures >= Global.breakerThreshold) {
+        breaker.openedAt = new Date().getTime();
+        breaker.trial    = false;
+        logWarn(function(){ return "Circuit breaker open: " + service + " failures: " + breaker.failures; });
+    }
+    Global.breakers[service] = breaker;
+};
+
+/**
+ * Fetch the weather from a provider and deliver the first valid record to the pebble.
+ * The secondary provider is started when the primary fails. A hedged fetch also
+ * starts it when the primary has not answered within Global.hedgeDelay, and whichever
+ * request loses the race is aborted.
+ *
+ * @param primary   Service of the provider to ask first
+ * @param secondary Service of the provider to fall back on, or null
+ * @param hedge     True to race the secondary against a slow primary
+ * @param latitude  Latitude portion of the GPS location we want data on
+ * @param longitude Longitude portion of the GPS location we want data on
+ */
+var fetchWeather = function(primary, secondary, hedge, latitude, longitude)
+{
+    var started  = new Date().getTime();
+    var requests = {};
+    var tried    = {}; // services started, each is asked once
+    var done     = false;
+    var hedgeTimer = null;
+    
+    var finish = function(service, err, weather) {
+        delete requests[service];
+        if (done) {
+            return;
+        }
+        if (!err) {
+            breakerSuccess(service);
+            done = true;
+            clearTimeout(hedgeTimer);
+            Object.keys(requests).forEach(function(loser) {
+                logDebug(function(){ return "Aborting slower provider: " + loser; });
+                requests[loser].abort();
+                breakerAbandon(loser);
+            });
+            recordTimeToWeather(hedge, new Date().getTime() - started);
+            deliverWeather(weather, service);
+            Global.updateInProgress = false;
+            return;
+        }
+        logWarn(function(){ return "Could not find weather data in " + service + " response: " + err; });
+        breakerFailure(service);
+        if (secondary !== null && !tried.hasOwnProperty(secondary) && service === primary) {
+            clearTimeout(hedgeTimer);
+            start(secondary);
+        } else if (Object.keys(requests).length === 0) {
+            done = true;
+            deliverError();
+            Global.updateInProgress = false;
+        }
+    };
+    
+    var start = function(service) {
+        var options = Providers[service](latitude, longitude);
+        if (service === SERVICE_WUNDER_WEATHER) {
+            wuQuotaConsume();
+        }
+        logDebug(function(){ return 'URL: ' + options.url; });
+        breakerStart(service);
+        tried[service]    = true;
+        requests[service] = { abort: function() {} };
+        traceStage('fetchStart');
+        var req = getJson(options.url, function(err, response) {
+            var weather = null;
+            var fetched = new Date().getTime();
+            if (!err) {
+                try {
+                    weather = options.parse(response);
+                    // the aggregator reports which provider's condition codes it serves,
+                    // the other services serve their own
+                    if (service !== SERVICE_AGGREGATOR) {
+                        weather.provider = service;
+                    }
+                } catch (ex) {
+                    err = ex.message;
+                }
+            }
+            if (!err && !done) {
+                traceStage('fetchEnd', fetched);
+                traceStage('parsed');
+            }
+            finish(service, err, weather);
+        });
+        if (req !== null && requests.hasOwnProperty(service)) {
+            requests[service] = req;
+        }
+    };
+    
+    start(primary);
+    if (hedge && secondary !== null && !done) {
+        hedgeTimer = setTimeout(function() {
+            if (!done && !tried.hasOwnProperty(secondary)) {
+                logDebug(function(){ return "No answer from " + primary + " in " + Global.hedgeDelay +
+                                            "ms, hedging with " + secondary; });
+                start(secondary);
+            }
+        }, Global.hedgeDelay);
+    }
+};
+
+/**
+ * Convert a provider temperature into tenths of a degree Celsius, the unit the pebble
+ * stores temperatures in. The pebble converts to the configured scale for display.
+ *
+ * @param value Temperature reported by the provider
+ * @param unit  'C', 'F' or 'K'
+ */
+var toTenthsCelsius = function(value, unit)
+{
+    var celsius = parseFloat(value);
+    if (unit === 'F') {
+        celsius = (celsius - 32) / 1.8;
+    } else if (unit === 'K') {
+        celsius = celsius - 273.15;
+    }
+    return Math.round(celsius * 10);
+};
+
+/**
+ * Quantize a position to the grid cell used as key for cached lookups
+ *
+ * @param latitude  Latitude of the position
+ * @param longitude Longitude of the position
+ */
+var locationCell = function(latitude, longitude)
+{
+    return Math.round(latitude / Global.cellSize) + ',' + Math.round(longitude / Global.cellSize);
+};
+
+/**
+ * Find the cached place (WOEID and locale) of a cell
+ *
+ * @param cell Cell key from locationCell
+ */
+var lookupPlace = function(cell)
+{
+    try {
+        var places = JSON.parse(localStorage.getItem('places')) || {};
+        return places[cell] || null;
+    } catch (ex) {
+        return null;
+    }
+};
+
+/**
+ * Cache the place (WOEID and locale) of a cell, dropping the oldest cached place
+ * once Global.maxCachedPlaces is reached
+ *
+ * @param cell  Cell key from locationCell
+ * @param place Object with woeid and locale
+ */
+var storePlace = function(cell, place)
+{
+    var places;
     try {
-        var req = new XMLHttpRequest();
-        req.open('GET', url, true);
-        req.onload = function(e) {
-            if (req.readyState == 4) {
-                if(req.status == 200) {
-                    try {
-                        //console.log(req.responseText);
-                        var response = JSON.parse(req.responseText);
-                        callback(null, response);
-                    } catch (ex) {
-                        callback(ex.message);
-                    }
-                } else {
-                    callback("Error request status not 200, status: "+req.status);
-                }
-            }
-        };
-        req.send(null);
-    } catch(ex) {
-        callback("Unable to GET JSON: "+ex.message);
+        places = JSON.parse(localStorage.getItem('places')) || {};
+    } catch (ex) {
+        places = {};
     }
+    var cells = Object.keys(places);
+    if (!places.hasOwnProperty(cell) && cells.length >= Global.maxCachedPlaces) {
+        cells.sort(function(a, b) { return places[a].time - places[b].time; });
+        delete places[cells[0]];
+    }
+    place.time   = new Date().getTime();
+    places[cell] = place;
+    localStorage.setItem('places', JSON.stringify(places));
 };
 
 /**
- * Given options, make the weather data request through the connected device
+ * Normalize a Yahoo weather.forecast channel
  *
- * @param options Options which specify url and parameters for the request
+ * @param channel The channel of the weather.forecast result
+ * @param locale  Name of the place the forecast is for
  */
-var fetchWeather = function(options)
+var parseYahooChannel = function(channel, locale)
 {
-    console.log('URL: ' + options.url);
-    getJson(options.url, function(err, response) {
-        try {
-            if (err) {
-                throw err;
-            }
-
-            var weather = options.parse(response);
-            console.log('Weather Data: ' + JSON.stringify(weather));
-
-            Pebble.sendAppMessage(weather, ack, function(e){
-                                  nack(weather);
-                                  });
-            postDebugMessage(weather);
-
-        } catch (ex) {
-            console.warn("Could not find weather data in response: " + ex.message);
-            var error = { "error": "HTTP Error" };
-            Pebble.sendAppMessage(error, ack, nack);
-            postDebugMessage(error);
-        }
-        Global.updateInProgress = false;
-    });
+    var sunrise = channel.astronomy.sunrise;
+    var sunset  = channel.astronomy.sunset;
+    var pubdate = new Date(Date.parse(channel.item.pubDate));
+    
+    return {
+        condition:   parseInt(channel.item.condition.code),
+        temperature: toTenthsCelsius(channel.item.condition.temp, 'F'),
+        sunrise:     Date.parse(new Date().toDateString()+" "+sunrise) / 1000,
+        sunset:      Date.parse(new Date().toDateString()+" "+sunset) / 1000,
+        locale:      locale,
+        pubdate:     pubdate.getHours()+':'+('0'+pubdate.getMinutes()).slice(-2),
+        observed:    pubdate.getTime(),
+        tzoffset:    new Date().getTimezoneOffset() * 60
+    };
 };
 
 /**
- * Fetch weather data from Yahoo
+ * Build the request options for Yahoo. The WOEID and locale of the location are cached
+ * per cell, so only the first fetch in a cell has to resolve them with geo.placefinder.
  *
  * @param latitude  Latitude portion of the GPS location we want data on
  * @param longitude Longitude portion of the GPS location we want data on
  */
-var fetchYahooWeather = function(latitude, longitude)
+var yahooWeatherOptions = function(latitude, longitude)
 {
     var subselect, neighbor, query, multi, options = {};
+    var cell  = locationCell(latitude, longitude);
+    var place = lookupPlace(cell);
+    
+    if (place !== null) {
+        query       = 'SELECT * FROM weather.forecast WHERE woeid='+place.woeid+' AND u="f"';
+        // no cache busting parameter, the url is the key of the conditional request cache
+        options.url = "https://query.yahooapis.com/v1/public/yql?format=json&q="+encodeURIComponent(query);
+        
+        options.parse = function(response) {
+            return parseYahooChannel(response.query.results.channel, place.locale);
+        };
+        
+        return options;
+    }
     
     subselect   = 'SELECT woeid FROM geo.placefinder WHERE text="'+latitude+','+longitude+'" AND gflags="R"';
     neighbor    = 'SELECT * FROM geo.placefinder WHERE text="'+latitude+','+longitude+'" AND gflags="R";';
-    query       = 'SELECT * FROM weather.forecast WHERE woeid IN ('+subselect+') AND u="'+Global.config.weatherScale.toLowerCase()+'";';
+    query       = 'SELECT * FROM weather.forecast WHERE woeid IN ('+subselect+') AND u="f";';
     multi       = "SELECT * FROM yql.query.multi WHERE queries='"+query+" "+neighbor+"'";
-    options.url = "https://query.yahooapis.com/v1/public/yql?format=json&q="+encodeURIComponent(multi)+"&nocache="+new Date().getTime();
+    options.url = "https://query.yahooapis.com/v1/public/yql?format=json&q="+encodeURIComponent(multi);
     
     options.parse = function(response) {
-        var sunrise, sunset, pubdate, locale;
-        sunrise = response.query.results.results[0].channel.astronomy.sunrise;
-        sunset  = response.query.results.results[0].channel.astronomy.sunset;
-        pubdate = new Date(Date.parse(response.query.results.results[0].channel.item.pubDate));
-        locale  = response.query.results.results[1].Result.neighborhood;
+        var result, locale;
+        result = response.query.results.results[1].Result;
+        locale = result.neighborhood;
         if (locale === null) {
-            locale = response.query.results.results[1].Result.city;
+            locale = result.city;
         }
         if (locale === null) {
             locale = 'unknown';
         }
         
-        return {
-            condition:   parseInt(response.query.results.results[0].channel.item.condition.code),
-            temperature: parseInt(response.query.results.results[0].channel.item.condition.temp),
-            sunrise:     Date.parse(new Date().toDateString()+" "+sunrise) / 1000,
-            sunset:      Date.parse(new Date().toDateString()+" "+sunset) / 1000,
-            locale:      locale,
-            pubdate:     pubdate.getHours()+':'+('0'+pubdate.getMinutes()).slice(-2),
-            tzoffset:    new Date().getTimezoneOffset() * 60
-        };
+        var weather = parseYahooChannel(response.query.results.results[0].channel, locale);
+        storePlace(cell, { woeid: result.woeid, locale: locale });
+        return weather;
     };
     
-    fetchWeather(options); 
+    return options;
 };
 
 /**
- * Fetch weather data from Open Weather Map
+ * Build the request options for Open Weather Map
  *
  * @param latitude  Latitude portion of the GPS location we want data on
  * @param longitude Longitude portion of the GPS location we want data on
  */
-var fetchOpenWeather = function(latitude, longitude)
+var openWeatherOptions = function(latitude, longitude)
 {
     var options = {};
     options.url = "http://api.openweathermap.org/data/2.5/weather?lat=" + latitude +
@@ -242,16 +1292,7 @@ var fetchOpenWeather = function(latitude, longitude)
     options.parse = function(response) {
         var temperature, sunrise, sunset, condition, pubdate;
         
-        var tempResult = response.main.temp;
-        if (Global.config.weatherScale === 'C') {
-            // Convert temperature to Celsius
-            temperature = Math.round(tempResult - 273.15);
-        }
-        else {
-            // Otherwise, convert temperature to Fahrenheit
-            temperature = Math.round(((tempResult - 273.15) * 1.8) + 32);
-        }
-        
+        temperature = toTenthsCelsius(response.main.temp, 'K');
         condition = response.weather[0].id;
         sunrise   = response.sys.sunrise;
         sunset    = response.sys.sunset;
@@ -264,10 +1305,11 @@ var fetchOpenWeather = function(latitude, longitude)
             sunset:      sunset,
             locale:      response.name,
             pubdate:     pubdate.getHours()+':'+('0'+pubdate.getMinutes()).slice(-2),
+            observed:    pubdate.getTime(),
             tzoffset:    new Date().getTimezoneOffset() * 60
         };
     };
-    fetchWeather(options);
+    return options;
 };
 
 /**
@@ -356,28 +1398,29 @@ var wunderConditionsToEnum = function( str_conditions )
             return offset + i;
         }
     }
-    console.log( "wunderConditionsToEnum: failed to find a match for str_conditions:" +
-                 str_conditions );
+    logDebug(function(){ return "wunderConditionsToEnum: failed to find a match for str_conditions:" +
+                                 str_conditions; });
     return -1;
 };
 
 /**
- * Fetch weather data for the current conditions from Weather Underground
+ * Build the request options for the current conditions from Weather Underground
+ *
+ * @param latitude  Latitude portion of the GPS location we want data on
+ * @param longitude Longitude portion of the GPS location we want data on
  */
-var fetchWunderWeather = function( latitude, longitude )
+var wunderWeatherOptions = function( latitude, longitude )
 {
     var options = {};
     options.url = 'http://api.wunderground.com/api/' + Global.wuApiKey +
-        '/conditions/astronomy/hourly/alerts/q/' + latitude + ',' + longitude + '.json';
+        '/conditions/astronomy/' + (Global.hourlyWanted ? 'hourly/' : '') +
+        'alerts/q/' + latitude + ',' + longitude + '.json';
     // define the parse function for handling the response
     options.parse = function(response)
     {
         // Current weather conditions
-        var metric = Global.config.weatherScale === 'C';
         var condition = wunderConditionsToEnum( response.current_observation.weather );
-        var temperature = (metric) ?
-            response.current_observation.temp_c :
-            response.current_observation.temp_f;
+        var temperature = toTenthsCelsius( response.current_observation.temp_c, 'C' );
         var sunrise = 0;
         var sunset = 0;
         var locale = response.display_location.full;
@@ -394,66 +1437,235 @@ var fetchWunderWeather = function( latitude, longitude )
         var rise_date = new Date( 0, 0, 0, rise_hour, rise_minute, 0 ,0 );
         var set_date = new Date( 0, 0, 0, set_hour, set_minute, 0, 0 );
         
-        // Hourly forecast data
-        var h1 = response.hourly_forecast[Global.hourlyIndex1];
-        var h2 = response.hourly_forecast[Global.hourlyIndex2];
-        
         // Active Alert data
         
-        return {
+        var data = {
             condition:   condition,
             temperature: temperature,
             sunrise:     rise_date.getTime(),
             sunset:      set_date.getTime(),
             locale:      locale,
             pubdate:     pubdate.getHours() + ':' + ('0' + pubdate.getMinutes()).slice(-2),
+            observed:    pubdate.getTime(),
             tzoffset:    new Date().getTimezoneOffset() * 60
-            h1_temp: Global.config.weatherScale === 'C' ? parseInt(h1.temp.metric) :
-                parseInt(h1.temp.english),
-            h1_cond: parseInt(h1.fctcode),
-            h1_time: parseInt(h1.FCTTIME.epoch),
-            h1_pop:  parseInt(h1.pop),
-            h2_temp: Global.config.weatherScale === 'C' ? parseInt(h2.temp.metric) :
-                parseInt(h2.temp.english),
-            h2_cond: parseInt(h2.fctcode),
-            h2_time: parseInt(h2.FCTTIME.epoch),
-            h2_pop:  parseInt(h2.pop)
         };
+        
+        // Hourly forecast data, left out of the request in the pebble's power saving modes
+        if (response.hourly_forecast)
+        {
+            var h1 = response.hourly_forecast[Global.hourlyIndex1];
+            var h2 = response.hourly_forecast[Global.hourlyIndex2];
+            data.h1_temp = toTenthsCelsius(h1.temp.metric, 'C');
+            data.h1_cond = parseInt(h1.fctcode);
+            data.h1_time = parseInt(h1.FCTTIME.epoch);
+            data.h1_pop  = parseInt(h1.pop);
+            data.h2_temp = toTenthsCelsius(h2.temp.metric, 'C');
+            data.h2_cond = parseInt(h2.fctcode);
+            data.h2_time = parseInt(h2.FCTTIME.epoch);
+            data.h2_pop  = parseInt(h2.pop);
+        }
+        return data;
     };
-    fetchWeather( options );
+    return options;
 };
 
 /**
- * Fetch weather data from Weather Underground
+ * Build the request options for a self hosted aggregator (see tools/aggregator). It
+ * answers with an already normalized record for the location's cell, shared by every
+ * device in that cell; only the parts depending on the phone's clock are filled in here.
  *
  * @param latitude  Latitude portion of the GPS location we want data on
  * @param longitude Longitude portion of the GPS location we want data on
  */
-var fetchHourlyWunderWeather = function(latitude, longitude)
+var aggregatorWeatherOptions = function(latitude, longitude)
 {
     var options = {};
-    options.url = 'http://api.wunderground.com/api/' + Global.wuApiKey +
-        '/hourly/q/' + latitude + ',' + longitude + '.json';
+    // only the cell leaves the phone, the aggregator fetches for the cell centre
+    options.url = Global.aggregatorUrl + '?' + serialize({
+        cell: locationCell(latitude, longitude)
+    });
     
-    options.parse = function(response)
-    {
-        var h1 = response.hourly_forecast[Global.hourlyIndex1],
-        h2 = response.hourly_forecast[Global.hourlyIndex2];
-        
-        return {
-            h1_temp: Global.config.weatherScale === 'C' ? parseInt(h1.temp.metric) :
-                parseInt(h1.temp.english),
-            h1_cond: parseInt(h1.fctcode),
-            h1_time: parseInt(h1.FCTTIME.epoch),
-            h1_pop:  parseInt(h1.pop),
-            h2_temp: Global.config.weatherScale === 'C' ? parseInt(h2.temp.metric) :
-                parseInt(h2.temp.english),
-            h2_cond: parseInt(h2.fctcode),
-            h2_time: parseInt(h2.FCTTIME.epoch),
-            h2_pop:  parseInt(h2.pop)
-        };
+    options.parse = function(response) {
+        if (typeof response.temperature !== 'number' || typeof response.observed !== 'number') {
+            throw new Error("Invalid aggregator response");
+        }
+        // the condition codes are only meaningful to the pebble for a provider it knows
+        if (response.provider !== SERVICE_OPEN_WEATHER &&
+            response.provider !== SERVICE_YAHOO_WEATHER &&
+            response.provider !== SERVICE_WUNDER_WEATHER) {
+            throw new Error("Unknown aggregator provider: " + response.provider);
+        }
+        var weather = {};
+        WEATHER_FIELDS.forEach(function(field) {
+            if (response.hasOwnProperty(field)) {
+                weather[field] = response[field];
+            }
+        });
+        var pubdate = new Date(response.observed);
+        weather.pubdate  = pubdate.getHours()+':'+('0'+pubdate.getMinutes()).slice(-2);
+        weather.observed = response.observed;
+        weather.tzoffset = new Date().getTimezoneOffset() * 60;
+        return weather;
     };
-    fetchWeather(options);
+    return options;
+};
+
+/**
+ * Request option builders by service
+ */
+var Providers = {};
+Providers[SERVICE_YAHOO_WEATHER]  = yahooWeatherOptions;
+Providers[SERVICE_OPEN_WEATHER]   = openWeatherOptions;
+Providers[SERVICE_WUNDER_WEATHER] = wunderWeatherOptions;
+Providers[SERVICE_AGGREGATOR]     = aggregatorWeatherOptions;
+
+/**
+ * The provider the user configured, the aggregator when there is an endpoint and
+ * Weather Underground when there is an api key
+ */
+var primaryProvider = function()
+{
+    if ( Global.aggregatorUrl !== null ) // implies SERVICE_AGGREGATOR
+    {
+        return SERVICE_AGGREGATOR;
+    }
+    if ( Global.wuApiKey !== null ) // implies SERVICE_WUNDER_WEATHER
+    {
+        return SERVICE_WUNDER_WEATHER;
+    }
+    return Global.config.weatherService === SERVICE_OPEN_WEATHER ?
+        SERVICE_OPEN_WEATHER : SERVICE_YAHOO_WEATHER;
+};
+
+/**
+ * Load the persisted Weather Underground token bucket, refilled for the time passed.
+ * Tokens refill evenly over the day so the budget left after the reserve is spread out.
+ */
+var loadWuQuota = function()
+{
+    var now   = new Date().getTime();
+    var today = new Date().toDateString();
+    var quota = null;
+    try {
+        quota = JSON.parse(localStorage.getItem('wuQuota'));
+    } catch (ex) {
+        quota = null;
+    }
+    if (quota === null) {
+        quota = { tokens: Global.wuQuota.burst, updated: now, day: today, used: 0, last: 0 };
+    }
+    var rate = (Global.wuQuota.dailyLimit - Global.wuQuota.reserve) / (24 * 60 * 60 * 1000);
+    quota.tokens  = Math.min(Global.wuQuota.burst, quota.tokens + (now - quota.updated) * rate);
+    quota.updated = now;
+    if (quota.day !== today) {
+        quota.day  = today;
+        quota.used = 0;
+    }
+    return quota;
+};
+
+/**
+ * Check whether the current local time falls in the configured quiet hours
+ */
+var isQuietHour = function()
+{
+    var hour = new Date().getHours();
+    if (Global.config.quietStart <= Global.config.quietEnd) {
+        return hour >= Global.config.quietStart && hour < Global.config.quietEnd;
+    }
+    return hour >= Global.config.quietStart || hour < Global.config.quietEnd;
+};
+
+/**
+ * Check whether the Weather Underground budget allows another call. Refreshes the
+ * user asked for may dip into the reserve, others need a token and are limited
+ * to one per Global.wuQuota.quietInterval during quiet hours.
+ *
+ * @param userInitiated True if the user asked for the refresh
+ */
+var wuQuotaAllows = function(userInitiated)
+{
+    var quota = loadWuQuota();
+    var allowed;
+    if (quota.used >= Global.wuQuota.dailyLimit) {
+        allowed = false;
+    } else if (userInitiated) {
+        allowed = true;
+    } else if (quota.used >= Global.wuQuota.dailyLimit - Global.wuQuota.reserve) {
+        allowed = false;
+    } else if (isQuietHour() && new Date().getTime() - quota.last < Global.wuQuota.quietInterval) {
+        allowed = false;
+    } else {
+        allowed = quota.tokens >= 1;
+    }
+    if (!allowed) {
+        logDebug(function(){ return "Weather Underground quota: call deferred, remaining today: " +
+                                    (Global.wuQuota.dailyLimit - quota.used) + " tokens: " + quota.tokens.toFixed(2); });
+    }
+    return allowed;
+};
+
+/**
+ * Account for a Weather Underground call
+ */
+var wuQuotaConsume = function()
+{
+    var quota = loadWuQuota();
+    quota.tokens = Math.max(0, quota.tokens - 1);
+    quota.used++;
+    quota.last = new Date().getTime();
+    localStorage.setItem('wuQuota', JSON.stringify(quota));
+    
+    var remaining = Global.wuQuota.dailyLimit - quota.used;
+    logDebug(function(){ return "Weather Underground quota: remaining today: " + remaining +
+                                " tokens: " + quota.tokens.toFixed(2); });
+    postDebugMessage({ "wuQuotaRemaining": remaining });
+};
+
+/**
+ * Every provider which may be asked, in order of preference
+ */
+var providerCandidates = function()
+{
+    var candidates = [primaryProvider(), SERVICE_YAHOO_WEATHER, SERVICE_OPEN_WEATHER,
+                      SERVICE_WUNDER_WEATHER];
+    return candidates.filter(function(service, i) {
+        return candidates.indexOf(service) === i;
+    });
+};
+
+/**
+ * Why a provider cannot be asked right now
+ *
+ * @param service       The provider
+ * @param userInitiated True if the user asked for the refresh
+ * @return The reason, or null if it can be asked
+ */
+var providerUnavailable = function(service, userInitiated)
+{
+    if (breakerState(service) === BREAKER_OPEN) {
+        return "circuit breaker open";
+    }
+    if (service === SERVICE_WUNDER_WEATHER && Global.wuApiKey === null) {
+        return "no api key";
+    }
+    if (service === SERVICE_WUNDER_WEATHER && !wuQuotaAllows(userInitiated)) {
+        return "quota exhausted";
+    }
+    return null;
+};
+
+/**
+ * The providers to use in order of preference, leaving out those with an open breaker
+ * and Weather Underground when its budget does not allow another call
+ *
+ * @param userInitiated True if the user asked for the refresh
+ */
+var providerChain = function(userInitiated)
+{
+    return providerCandidates().filter(function(service) {
+        return providerUnavailable(service, userInitiated) === null;
+    });
 };
 
 /**
@@ -472,6 +1684,37 @@ var serialize = function(obj) {
     return str.join("&");
 };
 
+/**
+ * Great circle distance between two positions using the haversine formula
+ *
+ * @return The distance in meters
+ */
+var distance = function(lat1, lon1, lat2, lon2)
+{
+    var toRad = Math.PI / 180;
+    var dLat  = (lat2 - lat1) * toRad;
+    var dLon  = (lon2 - lon1) * toRad;
+    var a = Math.sin(dLat / 2) * Math.sin(dLat / 2) +
+        Math.cos(lat1 * toRad) * Math.cos(lat2 * toRad) *
+        Math.sin(dLon / 2) * Math.sin(dLon / 2);
+    return 2 * EARTH_RADIUS * Math.atan2(Math.sqrt(a), Math.sqrt(1 - a));
+};
+
+/**
+ * Check whether a position lies outside the cell the current weather was fetched for
+ *
+ * @param latitude  Latitude of the position
+ * @param longitude Longitude of the position
+ */
+var isOutsideCell = function(latitude, longitude)
+{
+    if (Global.weatherDataLat === null || Global.weatherDataLong === null) {
+        return true;
+    }
+    return distance(Global.weatherDataLat, Global.weatherDataLong,
+                    latitude, longitude) > Global.geofenceRadius;
+};
+
 /**
  * Fetches weather data from the selected weather source for the specified location
  *
@@ -480,80 +1723,106 @@ var serialize = function(obj) {
  */
 var queryWeatherConditions = function(latitude, longitude)
 {
-    var x = (longitude - Global.weatherDataLong) *
-        Math.cos( (Global.weatherDataLat + latitude) / 2 );
-    var y = (latitude - Global.weatherDataLat);
-    var d = Math.sqrt( (x * x) + (y * y) ) * EARTH_RADIUS;
-    
-    // Rate limiting check. Only update if enough time has pased...
-    // ... or there has been a substantial change in location
-    var nextUpdateTime = Global.lastUpdateAttempt.getTime() + Global.updateWaitTimeout;
-    if ( Global.updateInProgress && new Date().getTime() < nextUpdateTime && d < 1000 )
-    {
-        console.log("queryWeatherConditions: too quickly requesting updates");
-        return;
-    }
-    
+    // Rate limited by updateWeather, the location watch asks it once the position
+    // left the current cell
     Global.updateInProgress  = true;
     Global.lastUpdateAttempt = new Date();
+    // the geofence is centred on the cell, as the aggregator's cellCentre() is
+    Global.weatherDataLat    = Math.round(latitude / Global.cellSize) * Global.cellSize;
+    Global.weatherDataLong   = Math.round(longitude / Global.cellSize) * Global.cellSize;
     
-    if ( Global.wuApiKey !== null ) // implies SERVICE_WUNDER_WEATHER
+    // Providers whose breaker is open are skipped until their cool-down has passed
+    var userRefresh = Global.userRefresh;
+    var chain = providerChain(userRefresh);
+    Global.userRefresh = false;
+    if ( chain.length === 0 )
     {
-        fetchWunderWeather( latitude, longitude );
+        var reasons = providerCandidates().map(function(service) {
+            return service + ": " + providerUnavailable(service, userRefresh);
+        });
+        logWarn("queryWeatherConditions: no provider available, " + reasons.join(", "));
+        // the pebble's request is answered, the next one tries again
+        deliverError("No provider");
+        Global.updateInProgress = false;
+        return;
     }
-    else if ( Global.config.weatherService === SERVICE_OPEN_WEATHER )
+    fetchWeather( chain[0], chain.length > 1 ? chain[1] : null, Global.config.hedgeEnabled,
+                  latitude, longitude );
+};
+
+/**
+ * Query the weather for the home location, or tell the pebble there is no location
+ *
+ * @param message Why the current location could not be used
+ */
+var queryHomeWeatherConditions = function (message)
+{
+    // If we have a home location, use it
+    if ( Global.config.homeWeatherLat !== 0.0 && Global.config.homeWeatherLong !== 0.0 )
     {
-        fetchOpenWeather(latitude, longitude);
+        logDebug("Using home location for weather forcast query");
+        queryWeatherConditions( Global.config.homeWeatherLat,
+                               Global.config.homeWeatherLong );
     }
-    else if ( Global.config.weatherService === SERVICE_YAHOO_WEATHER )
+    else
     {
-        fetchYahooWeather(latitude, longitude);
+        // We're out of luck on location data, Location is off and no home defined
+        Global.lastAckedHash = null;
+        sendMessage(MSG_WEATHER, { "error": "Loc unavailable" });
+        postDebugMessage({"error": message});
+        Global.updateInProgress = false;
     }
-    
-    // Leverage WeatherUnderground if we have a key
-    //if ( Global.wuApiKey !== null )
-    //{
-    //    fetchHourlyWunderWeather(latitude, longitude);
-    //}
-    //else
-    //{
-    //    var data = {hourly_enabled: 0};
-    //    console.log("Hourly disabled, no WU ApiKey");
-    //    Pebble.sendAppMessage(data, ack, function(ev){ nack(data); });
-    //}
 };
 
-
+/**
+ * Remember a position fix
+ *
+ * @param pos position data
+ */
+var recordFix = function (pos)
+{
+    Global.lastFix = {
+        lat:  pos.coords.latitude,
+        lon:  pos.coords.longitude,
+        time: pos.timestamp || new Date().getTime()
+    };
+    logDebug(function(){ return "Got coordinates: " + Global.lastFix.lat + "," + Global.lastFix.lon +
+                                " accuracy: " + pos.coords.accuracy; });
+};
 
 /**
  * Called whenever the weather data is out of date, fetches the current
- * location we want weather data for 
+ * location we want weather data for. A recent coarse fix is reused, otherwise
+ * the platform is asked for a cached one.
+ *
+ * @param userInitiated True if the user asked for the refresh
  */
-var updateWeather = function ()
+var updateWeather = function (userInitiated)
 {
     var nextUpdateTime = Global.lastUpdateAttempt.getTime() + Global.updateWaitTimeout;
     if (Global.updateInProgress && new Date().getTime() < nextUpdateTime)
     {
-        console.log("Update already started in the last " +
-                    (Global.updateWaitTimeout/60000) + " minutes");
+        logDebug(function(){ return "Update already started in the last " +
+                                    (Global.updateWaitTimeout/60000) + " minutes"; });
         return false;
     }
-    if ( Global.locationWatchingId === 0 )
+    Global.userRefresh = userInitiated === true;
+    // the location fix is part of the update, resends during it join the update
+    Global.updateInProgress  = true;
+    Global.lastUpdateAttempt = new Date();
+    if ( !Global.config.trackLocation || !navigator.geolocation )
     {
-        //var locationOptions = {
-        //    "enableHighAccuracy": false,
-        //    "timeout": 15000,
-        //    "maximumAge": 60000
-        //};
-        //navigator.geolocation.getCurrentPosition( locationSuccess, locationError,
-        //                                          locationOptions );
-        
-        queryWeatherConditions( Global.config.homeWeatherLat,
-                                Global.config.homeWeatherLong );
+        queryHomeWeatherConditions("Location tracking disabled");
+    }
+    else if ( Global.lastFix !== null &&
+              new Date().getTime() - Global.lastFix.time < Global.locationOptions.maximumAge )
+    {
+        queryWeatherConditions( Global.lastFix.lat, Global.lastFix.lon );
     }
     else
     {
-        console.log("Ignoring request to update, location monitoring is active");
+        navigator.geolocation.getCurrentPosition( locationSuccess, locationError,
+                                                  Global.locationOptions );
     }
     return true;
 };
@@ -565,9 +1834,8 @@ var updateWeather = function ()
  */
 var locationSuccess = function (pos)
 {
-    var coordinates = pos.coords;
-    console.log("Got coordinates: " + JSON.stringify(coordinates));
-    updateWeather();
+    recordFix(pos);
+    queryWeatherConditions( Global.lastFix.lat, Global.lastFix.lon );
 };
 
 /** 
@@ -578,28 +1846,50 @@ var locationSuccess = function (pos)
 var locationError = function (err)
 {
     var message = 'Location error (' + err.code + '): ' + err.message;
-    console.warn(message);
+    logWarn(message);
     
-    // If we're trying to use position tracking, turn it off
-    if ( Global.locationWatchingId )
+    // An old fix is still better than the home location
+    if ( Global.lastFix !== null )
     {
-        // stop watching the location
-        navigator.geolocation.clearWatch( Global.locationWatchingId );
-        Global.locationWatchingId = 0;
+        queryWeatherConditions( Global.lastFix.lat, Global.lastFix.lon );
     }
-    
-    // If we have a home location, use it
-    if ( Global.config.homeWeatherLat !== 0.0 && Global.config.homeWeatherLong !== 0.0 )
-    {
-        console.log("Using home location for weather forcast query");
-        queryWeatherConditions( Global.config.homeWeatherLat,
-                               Global.config.homeWeatherLong );    }
     else
     {
-        // We're out of luck on location data, Location is off and no home defined
-        Pebble.sendAppMessage({ "error": "Loc unavailable" }, ack, nack);
-        postDebugMessage({"error": message});
-        Global.updateInProgress = false;
+        queryHomeWeatherConditions(message);
+    }
+};
+
+/**
+ * Called for every position update while the location is watched. The weather is
+ * only refetched once the position leaves the current cell, through updateWeather
+ * so an update already under way is not doubled.
+ *
+ * @param pos position data
+ */
+var locationWatchSuccess = function (pos)
+{
+    recordFix(pos);
+    if ( isOutsideCell( Global.lastFix.lat, Global.lastFix.lon ) )
+    {
+        logDebug("Left the current weather cell");
+        updateWeather(false);
+    }
+};
+
+/**
+ * Called when watching the location fails
+ *
+ * @param err Error information
+ */
+var locationWatchError = function (err)
+{
+    logWarn(function(){ return 'Location watch error (' + err.code + '): ' + err.message; });
+    
+    // If the user denied access there's no point in watching
+    if ( err.code === 1 && Global.locationWatchingId )
+    {
+        navigator.geolocation.clearWatch( Global.locationWatchingId );
+        Global.locationWatchingId = 0;
     }
 };
 
@@ -612,9 +1902,28 @@ var locationError = function (err)
  */
 var OnPebbleReady = function(e)
 {
-    console.log("Starting ...");
-    var data = { "js_ready": true };
-    Pebble.sendAppMessage(data, ack, function(e){ nack(data); });
+    logInfo("Starting ...");
+    loadConfig();
+    sendMessage(MSG_CONTROL, { "js_ready": true,
+                               "fetch_offset": Math.floor(fetchOffset() / 60000) });
+    
+    // Have the pebble's metrics and event log in the log when debugging
+    if (Global.config.debugEnabled) {
+        sendMessage(MSG_CONTROL, { "metrics": 1 });
+    }
+    
+    // Show the last weather right away, a fetch only follows once it is due
+    // the first watch fix only refetches once it is outside the cached record's cell
+    Global.cachedWeather = loadCachedWeather();
+    if (Global.cachedWeather !== null) {
+        if (typeof Global.cachedWeather.lat === 'number' && typeof Global.cachedWeather.lon === 'number') {
+            Global.weatherDataLat  = Global.cachedWeather.lat;
+            Global.weatherDataLong = Global.cachedWeather.lon;
+        }
+        pushCachedWeather();
+    }
+    Global.wuApiKey      = localStorage.getItem('wuApiKey');
+    Global.aggregatorUrl = localStorage.getItem('aggregatorUrl');
     var initialInstall = localStorage.getItem('initialInstall');
     if (initialInstall === null && Global.wuApiKey === null)
     {
@@ -624,37 +1933,131 @@ var OnPebbleReady = function(e)
         Pebble.showSimpleNotificationOnPebble( "API Key Needed", notif_text );
     }
     
-    var locationOptions = {
-        "enableHighAccuracy": false,
-        "timeout": 15000,
-        "maximumAge": 60000
-    };
-//    Global.locationWatchingId = navigator.geolocation.watchPosition(locationSuccess,
-//        locationError, locationOptions);
+    // Coarse fixes only, the weather is refetched when the position leaves the cell
+    if ( Global.config.trackLocation && navigator.geolocation )
+    {
+        Global.locationWatchingId = navigator.geolocation.watchPosition(locationWatchSuccess,
+            locationWatchError, Global.locationOptions);
+    }
 };
 
 Pebble.addEventListener("ready", OnPebbleReady);
 
 /**
- * Handle the appmessage event. Triggers checks to see if updated weather should be pulled
+ * Summarize the configuration the pebble shares with us, see config_version() in network.c
+ */
+var configVersion = function ()
+{
+    return (CONFIG_FORMAT << 8) |
+        (Global.config.weatherService === SERVICE_OPEN_WEATHER ? 1 << 0 : 0) |
+        (Global.config.weatherScale === 'C'                    ? 1 << 1 : 0) |
+        (Global.config.debugEnabled                            ? 1 << 2 : 0) |
+        (Global.config.batteryEnabled                          ? 1 << 3 : 0);
+};
+
+/**
+ * Log the metrics dumped by the pebble, little endian 32 bit values in METRIC_NAMES order
+ *
+ * @param data Byte array sent by the pebble
+ */
+var logMetrics = function(data)
+{
+    var metrics = {};
+    METRIC_NAMES.forEach(function(name, i) {
+        if (4 * i + 3 < data.length) {
+            metrics[name] = (data[4 * i] | (data[4 * i + 1] << 8) | (data[4 * i + 2] << 16) |
+                             (data[4 * i + 3] << 24)) >>> 0;
+        }
+    });
+    logInfo(function(){ return "Pebble metrics: " + JSON.stringify(metrics); });
+};
+
+/**
+ * Log the event log dumped by the pebble, oldest entry first. Each 8 byte entry is the
+ * pebble's local time as little endian 32 bit value, the event id, a, and b as little
+ * endian signed 16 bit value, see event_log_write() in event_log.c
+ *
+ * @param data Byte array sent by the pebble
+ */
+var logEvents = function(data)
+{
+    if (!isLogged(LOG_INFO)) {
+        return;
+    }
+    for (var i = 0; i + 7 < data.length; i += 8) {
+        var time = (data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (data[i + 3] << 24)) >>> 0;
+        var b    = data[i + 6] | (data[i + 7] << 8);
+        // the pebble's clock runs on local time, print it as is
+        var when = new Date(time * 1000).toISOString().replace('T', ' ').substr(0, 19);
+        logInfo("Pebble event " + when + " " + (EVENT_NAMES[data[i + 4]] || data[i + 4]) +
+                " a:" + data[i + 5] + " b:" + (b > 0x7FFF ? b - 0x10000 : b));
+    }
+};
+
+/**
+ * Handle the appmessage event. Triggers checks to see if updated weather should be pulled.
+ * The pebble only sends its full configuration until we have acknowledged it once,
+ * every other request just carries the config version.
  */
 var OnAppMessage = function(data)
 {
-    console.log("Got a message - Starting weather request ... " + JSON.stringify(data));
+    logDebug(function(){ return "Got a message - Starting weather request ... " + JSON.stringify(data); });
     try
     {
-        Global.config.weatherService = data.payload.service === SERVICE_OPEN_WEATHER ?
-            SERVICE_OPEN_WEATHER : SERVICE_YAHOO_WEATHER;
-        Global.config.debugEnabled   = data.payload.debug   === 1;
-        Global.config.batteryEnabled = data.payload.battery === 1;
-        Global.config.weatherScale   = data.payload.scale   === 'C' ? 'C' : 'F';
-        Global.wuApiKey              = localStorage.getItem('wuApiKey');
+        if (data.payload.hasOwnProperty('metrics') || data.payload.hasOwnProperty('events'))
+        {
+            logMetrics(data.payload.metrics || []);
+            logEvents(data.payload.events || []);
+            return;
+        }
+        
+        if (data.payload.hasOwnProperty('req_id'))
+        {
+            traceRequest(data.payload.req_id);
+        }
+        
+        if (data.payload.hasOwnProperty('hourly_enabled'))
+        {
+            Global.hourlyWanted = data.payload.hourly_enabled !== 0;
+        }
+        
+        if (data.payload.hasOwnProperty('service'))
+        {
+            Global.config.weatherService = data.payload.service === SERVICE_OPEN_WEATHER ?
+                SERVICE_OPEN_WEATHER : SERVICE_YAHOO_WEATHER;
+            Global.config.debugEnabled   = data.payload.debug   === 1;
+            Global.config.batteryEnabled = data.payload.battery === 1;
+            Global.config.weatherScale   = data.payload.scale   === 'C' ? 'C' : 'F';
+            storeConfig();
+        }
+        
+        if (data.payload.config_version !== configVersion())
+        {
+            logDebug("Config version mismatch, asking the pebble for its config");
+            Global.trace = null;
+            sendMessage(MSG_CONTROL, { "config_version": configVersion() });
+            return;
+        }
+        
+        // The first request after a warm start is answered by the cached record
+        var warmStart = Global.warmStart;
+        Global.warmStart = false;
+        if (warmStart && isCachedWeatherFresh()) {
+            logDebug("Cached weather is still fresh, skipping the fetch");
+            Global.trace = null;
+            return;
+        }
         
-        updateWeather();
+        // A resend of a request still being worked on is answered when that finishes,
+        // tell the pebble so it keeps waiting instead of timing out
+        if (!updateWeather() && data.payload.hasOwnProperty('req_id')) {
+            logDebug(function(){ return "Request " + data.payload.req_id + " joins the update in progress"; });
+            sendMessage(MSG_CONTROL, { "in_progress": data.payload.req_id });
+        }
     }
     catch (ex)
     {
-        console.warn("Could not retrieve data sent from Pebble: "+ex.message);
+        logError(function(){ return "Could not retrieve data sent from Pebble: "+ex.message; });
     }
 };
 
@@ -671,10 +2074,11 @@ var OnShowConfiguration = function (e)
         'd': Global.config.debugEnabled,
         'u': Global.config.weatherScale,
         'b': Global.config.batteryEnabled ? 'on' : 'off',
-        'a': Global.wuApiKey
+        'a': Global.wuApiKey,
+        'g': Global.aggregatorUrl
     };
     var url = CONFIGURATION_URL+'?'+serialize(options);
-    console.log('Configuration requested using url: '+url);
+    logDebug(function(){ return 'Configuration requested using url: '+url; });
     Pebble.openURL(url);
 };
 
@@ -697,17 +2101,20 @@ var OnWebviewClosed = function(e)
                 return;
             }
             
-            console.log("Settings received: "+JSON.stringify(settings));
+            logDebug(function(){ return "Settings received: "+JSON.stringify(settings); });
             
+            // The pebble converts temperatures itself, a scale change is only a redraw
+            var aggregatorUrl = settings.aggregatorUrl ? settings.aggregatorUrl : null;
             var refreshNeeded = (settings.service  !== Global.config.weatherService ||
-                                 settings.scale    !== Global.config.weatherScale   ||
-                                 settings.wuApiKey !== Global.wuApiKey);
+                                 settings.wuApiKey !== Global.wuApiKey ||
+                                 aggregatorUrl     !== Global.aggregatorUrl);
             
             Global.config.weatherService = settings.service === SERVICE_OPEN_WEATHER ? SERVICE_OPEN_WEATHER : SERVICE_YAHOO_WEATHER;
             Global.config.weatherScale   = settings.scale   === 'C' ? 'C' : 'F';
             Global.config.debugEnabled   = settings.debug   === 'true';
             Global.config.batteryEnabled = settings.battery === 'on';
             Global.wuApiKey              = settings.wuApiKey;
+            storeConfig();
             
             if (Global.wuApiKey !== null) {
                 localStorage.setItem('wuApiKey', Global.wuApiKey);
@@ -715,6 +2122,13 @@ var OnWebviewClosed = function(e)
                 localStorage.removeItem('wuApiKey');
             }
             
+            Global.aggregatorUrl = aggregatorUrl;
+            if (Global.aggregatorUrl !== null) {
+                localStorage.setItem('aggregatorUrl', Global.aggregatorUrl);
+            } else {
+                localStorage.removeItem('aggregatorUrl');
+            }
+            
             var config = {
                 service: Global.config.weatherService,
                 scale:   Global.config.weatherScale,
@@ -722,13 +2136,13 @@ var OnWebviewClosed = function(e)
                 battery: Global.config.batteryEnabled ? 1 : 0
             };
             
-            Pebble.sendAppMessage(config, ack, function(ev){ nack(config); });
+            sendMessage(MSG_CONFIG, config);
             
             if (refreshNeeded) {
-                updateWeather();
+                updateWeather(true);
             }
         } catch(ex) {
-            console.warn("Unable to parse response from configuration:"+ex.message);
+            logError(function(){ return "Unable to parse response from configuration:"+ex.message; });
         }
     }
 };
@@ -0,0 +1,113 @@
+#include <pebble.h>
+#include "latency.h"
+#include "log.h"
+
+/* Upper bounds of the round trip histogram buckets in ms, the last bucket is open */
+static const uint16_t LATENCY_BUCKETS[] = { 500, 1000, 2000, 4000, 8000 };
+#define LATENCY_BUCKET_COUNT (sizeof(LATENCY_BUCKETS) / sizeof(LATENCY_BUCKETS[0]) + 1)
+
+/* Number of recent round trips the histogram covers */
+#define LATENCY_SAMPLES 32
+
+static uint16_t pending_req_id = 0;
+static uint32_t pending_sent   = 0;
+
+static uint16_t samples[LATENCY_SAMPLES];
+static int      sample_count = 0;
+static int      sample_next  = 0;
+
+/* Breakdown of the most recent round trip */
+static uint16_t last_total = 0;
+static uint16_t last_stages[LATENCY_STAGE_COUNT];
+
+/**
+ * Milliseconds on the watch clock, wraps around but differences stay valid
+ */
+uint32_t latency_now_ms()
+{
+    time_t   seconds;
+    uint16_t millis;
+    time_ms(&seconds, &millis);
+    return (uint32_t)seconds * 1000 + millis;
+}
+
+/**
+ * Time of the last round trip not accounted for by the phone's stages, spent in
+ * transit over Bluetooth
+ */
+static int bluetooth_ms()
+{
+    int phone = 0;
+    for ( int i = 0; i < LATENCY_STAGE_COUNT; i++ )
+    {
+        phone += last_stages[i];
+    }
+    return last_total > phone ? last_total - phone : 0;
+}
+
+/**
+ * Start the span of a weather request
+ */
+void latency_request_sent( uint16_t req_id )
+{
+    pending_req_id = req_id;
+    pending_sent   = latency_now_ms();
+}
+
+/**
+ * Close the span of a weather request. The phone reports the duration of each of its
+ * stages as little endian 16 bit values in ms, what remains of the round trip was
+ * spent in transit over Bluetooth.
+ */
+void latency_response_received( uint16_t req_id, const uint8_t *stages, uint16_t length )
+{
+    if ( pending_req_id == 0 || req_id != pending_req_id )
+    {
+        LOG_DEBUG("Latency req:%u not pending", (unsigned int)req_id);
+        return;
+    }
+    pending_req_id = 0;
+    
+    uint32_t total = latency_now_ms() - pending_sent;
+    last_total = total > UINT16_MAX ? UINT16_MAX : total;
+    
+    for ( int i = 0; i < LATENCY_STAGE_COUNT; i++ )
+    {
+        last_stages[i] = (2 * i + 1 < length) ? (stages[2 * i] | (stages[2 * i + 1] << 8)) : 0;
+    }
+    
+    samples[sample_next] = last_total;
+    sample_next = (sample_next + 1) % LATENCY_SAMPLES;
+    if ( sample_count < LATENCY_SAMPLES )
+    {
+        sample_count++;
+    }
+    
+    LOG_DEBUG("Latency req:%u total:%u bt:%i wait:%u fetch:%u parse:%u queue:%u",
+              (unsigned int)req_id, (unsigned int)last_total, bluetooth_ms(),
+              last_stages[LATENCY_STAGE_WAIT], last_stages[LATENCY_STAGE_FETCH],
+              last_stages[LATENCY_STAGE_PARSE], last_stages[LATENCY_STAGE_QUEUE]);
+}
+
+/**
+ * Format the round trip histogram of the recent requests and the Bluetooth share of
+ * the last one, e.g. "3/5/1/0/0/0 bt320"
+ */
+void latency_format( char *buffer, size_t size )
+{
+    int counts[LATENCY_BUCKET_COUNT] = { 0 };
+    
+    for ( int i = 0; i < sample_count; i++ )
+    {
+        unsigned int bucket = 0;
+        while ( bucket < LATENCY_BUCKET_COUNT - 1 && samples[i] >= LATENCY_BUCKETS[bucket] )
+        {
+            bucket++;
+        }
+        counts[bucket]++;
+    }
+    
+    snprintf(buffer, size, "%i/%i/%i/%i/%i/%i bt%i",
+             counts[0], counts[1], counts[2], counts[3], counts[4], counts[5],
+             bluetooth_ms());
+}
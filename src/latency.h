@@ -0,0 +1,18 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/* Phone side stages of a weather request, in the order the phone reports them */
+typedef enum {
+  LATENCY_STAGE_WAIT = 0, // request received until the provider is asked (location lookup)
+  LATENCY_STAGE_FETCH,    // provider request until its response
+  LATENCY_STAGE_PARSE,    // response until the normalized weather record
+  LATENCY_STAGE_QUEUE,    // record until the message leaves the phone's outbox
+  LATENCY_STAGE_COUNT
+} LatencyStage;
+
+uint32_t latency_now_ms();
+void latency_request_sent( uint16_t req_id );
+void latency_response_received( uint16_t req_id, const uint8_t *stages, uint16_t length );
+void latency_format( char *buffer, size_t size );
+
+#endif
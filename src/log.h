@@ -0,0 +1,43 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ * Compile time log levels. Messages above LOG_LEVEL are compiled out together with
+ * their arguments, release builds keep warnings and errors only. Set the level with
+ * ./waf configure --log-level=debug
+ */
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_DEBUG   4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_WARNING
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...)   APP_LOG(APP_LOG_LEVEL_ERROR, fmt, ## __VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(fmt, ...) APP_LOG(APP_LOG_LEVEL_WARNING, fmt, ## __VA_ARGS__)
+#else
+#define LOG_WARNING(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...)    APP_LOG(APP_LOG_LEVEL_INFO, fmt, ## __VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...)   APP_LOG(APP_LOG_LEVEL_DEBUG, fmt, ## __VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...)
+#endif
+
+#endif
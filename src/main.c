@@ -7,6 +7,11 @@
 #include "battery_layer.h"
 #include "datetime_layer.h"
 #include "config.h"
+#include "metrics.h"
+#include "event_log.h"
+#include "log.h"
+#include "power.h"
+#include "latency.h"
 
 #define TIME_FRAME      (GRect(0, 3, 144, 168-6))
 #define DATE_FRAME      (GRect(1, 66, 144, 168-62))
@@ -20,10 +25,65 @@ static WeatherData *weather_data = NULL;
 /* Global variables to keep track of the UI elements */
 static Window *window = NULL;
 
-/* Need to wait for JS to be ready */
-const  int  MAX_JS_READY_WAIT = 5000; // 5s
+/* The weather is not refreshed on ticks until JS is ready, see init_network */
 static bool initial_request = true;
-static AppTimer *initial_jsready_timer = NULL;
+
+/* Startup is split so the clock is on screen before the rest is set up */
+static uint32_t init_started_ms = 0;
+static AppTimer *startup_timer = NULL;
+
+/* Refresh interval used until the phone suggests the next fetch */
+const  int  WEATHER_REFRESH_INTERVAL = 30 * 60; // 30 mins in seconds
+/* The reply lands after the tick that sent the request, the power mode interval is
+   shortened by this so the matching tick one interval later still refreshes */
+const  int  REFRESH_SLACK = 5 * 60; // 5 mins in seconds
+
+/* Bluetooth drops shorter than this are flaps, the user is not alerted */
+const  int  BT_DROP_GRACE = 15000; // 15s
+/* The connection has to be back this long before the weather is refreshed */
+const  int  BT_RECONNECT_SETTLE = 5000; // 5s
+static bool bt_connected = true;
+static bool bt_drop_alerted = false;
+static time_t bt_dropped_at = 0;
+static AppTimer *bt_timer = NULL;
+
+/**
+ * Check whether the weather should be refreshed on this minute tick
+ */
+static bool is_refresh_due( struct tm *tick_time )
+{
+    // Saving power stretches the time between refreshes
+    if (weather_data->updated != 0 &&
+        time(NULL) - weather_data->updated < power_min_refresh_interval() - REFRESH_SLACK)
+    {
+        return false;
+    }
+    // The phone suggests a time just after its provider publishes
+    if (weather_data->next_fetch != 0)
+    {
+        return time(NULL) >= weather_data->next_fetch;
+    }
+    // Otherwise every 30 mins, targeting 18 mins after the hour (Yahoo updates
+    // around then) moved by this device's offset
+    return tick_time->tm_min % 30 == (18 + weather_data->fetch_offset) % 30;
+}
+
+/**
+ * Check whether the weather restored at launch is recent enough to skip the
+ * initial request
+ */
+static bool is_weather_fresh()
+{
+    if (weather_data->updated == 0)
+    {
+        return false;
+    }
+    if (weather_data->next_fetch != 0)
+    {
+        return time(NULL) < weather_data->next_fetch;
+    }
+    return time(NULL) - weather_data->updated < WEATHER_REFRESH_INTERVAL;
+}
 
 /**
  * Handle the timer tick event
@@ -32,9 +92,12 @@ static void handle_tick( struct tm *tick_time, TimeUnits units_changed )
 {
     if (units_changed & MINUTE_UNIT)
     {
+        metrics_minute_tick();
+        event_log_minute_tick();
         time_layer_update();
         if (!initial_request)
         {
+            debug_next_page();
             debug_update_weather(weather_data);
             weather_layer_update(weather_data);
         }
@@ -62,44 +125,108 @@ static void handle_tick( struct tm *tick_time, TimeUnits units_changed )
      weather_layer_update(weather_data);
      */
     
-    // Refresh the weather info every 30 mins, targeting 18 mins after the hour
-    // (Yahoo updates around then)
-    if ((units_changed & MINUTE_UNIT) &&  (tick_time->tm_min % 30 == 18) &&
-        !initial_request)
+    // Refresh the weather info when it is due
+    if ((units_changed & MINUTE_UNIT) && !initial_request && is_refresh_due(tick_time))
     {
+        // fall back to the fixed schedule until the phone suggests the next time
+        weather_data->next_fetch = 0;
         request_weather(weather_data);
     }
 } 
 
 /**
- * Handle bluetooth connect/disconnect events
+ * The connection stayed down for BT_DROP_GRACE, alert the user
+ */
+static void bt_drop_timer_callback( void *data )
+{
+    bt_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
+    bt_drop_alerted = true;
+    
+    // alert the user by vibrating
+    vibes_double_pulse();
+    // invalidate the data and indicate an error
+    weather_data->error = WEATHER_E_PHONE;
+}
+
+/**
+ * The connection stayed up for BT_RECONNECT_SETTLE, refresh the weather unless it
+ * is still fresh
+ */
+static void bt_settle_timer_callback( void *data )
+{
+    bt_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
+    bt_drop_alerted = false;
+    
+    if (is_weather_fresh())
+    {
+        LOG_DEBUG("Bluetooth back, weather is fresh");
+        if (weather_data->error != WEATHER_E_OK)
+        {
+            weather_data->error = WEATHER_E_OK;
+            weather_layer_update(weather_data);
+        }
+        return;
+    }
+    // We've regained the bluetooth connection, request the current weather
+    request_weather(weather_data);
+}
+
+/**
+ * Handle bluetooth connect/disconnect events. A drop only alerts the user once it
+ * lasted BT_DROP_GRACE, and the weather is only refreshed once the connection is
+ * back for BT_RECONNECT_SETTLE, so a phone at the edge of range does not cause a
+ * burst of vibrations and requests.
  */
 static void handle_bt_event( bool connected )
 {
+    if ( connected == bt_connected )
+    {
+        return;
+    }
+    bt_connected = connected;
+    
+    if (bt_timer)
+    {
+        app_timer_cancel(bt_timer);
+        bt_timer = NULL;
+    }
+    
     if ( connected )
     {
-        // We've regained the bluetooth connection, request the current weather
-        request_weather(weather_data);
+        event_log(EVENT_BLUETOOTH, connected, time(NULL) - bt_dropped_at);
+        if (!bt_drop_alerted)
+        {
+            metrics_count(METRIC_BT_FLAPS);
+        }
+        bt_timer = app_timer_register(BT_RECONNECT_SETTLE, bt_settle_timer_callback, NULL);
     }
     else
     {
-        // alert the user by vibrating
-        vibes_double_pulse();
-        // invalidate the data and indicate an error
-        weather_data->error = WEATHER_E_PHONE;
+        event_log(EVENT_BLUETOOTH, connected, 0);
+        bt_dropped_at = time(NULL);
+        // the user was already alerted if the connection did not settle since
+        if (!bt_drop_alerted)
+        {
+            bt_timer = app_timer_register(BT_DROP_GRACE, bt_drop_timer_callback, NULL);
+        }
     }
 }
 
 /**
- * Wait for an official 'ready' from javascript or MAX_JS_READY_WAIT, whichever happens sooner 
+ * Called by the network on an official 'ready' from javascript or after it waited
+ * MAX_JS_READY_WAIT, whichever happens sooner 
  */
 void initial_jsready_callback()
 {
     initial_request = false;
     
-    if (initial_jsready_timer) {
-        app_timer_cancel(initial_jsready_timer);
-        initial_jsready_timer = NULL;
+    // The weather restored at launch is shown until it is due
+    if (is_weather_fresh())
+    {
+        LOG_DEBUG("Restored weather is fresh, skipping the initial request");
+        return;
     }
     
     // This isn't required, the JavaScript now takes care of the first weather query
@@ -108,47 +235,96 @@ void initial_jsready_callback()
 }
 
 /**
- * Initialize
+ * The power mode changed with the battery charge
  */
-static void init(void)
+static void handle_power_mode( PowerMode mode )
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "init started");
+    LOG_INFO("power mode %d", mode);
+    event_log(EVENT_POWER_MODE, mode, battery_state_service_peek().charge_percent);
     
-    window = window_create();
-    window_stack_push(window, true /* Animated */);
-    window_set_background_color(window, GColorBlack);
+    // Stop or restart the charging animation
+    battery_state_changed(battery_state_service_peek());
+    
+    // Hide the hourly forecast, it is no longer refreshed
+    if (!power_hourly_enabled() && weather_data->hourly_enabled)
+    {
+        weather_data->hourly_enabled = false;
+        weather_layer_update(weather_data);
+    }
+}
+
+/**
+ * Everything but the clock, set up once the event loop is running. The time to get
+ * here is logged as the event loop start, it is not a measurement of the first frame.
+ */
+static void startup_callback( void *data )
+{
+    startup_timer = NULL;
+    uint32_t loop_start_ms = latency_now_ms() - init_started_ms;
+    
+    metrics_init();
+    event_log_init();
     
     weather_data = malloc(sizeof(WeatherData));
     init_network(weather_data);
     
-    // Setup our layers
-    time_layer_create(TIME_FRAME, window);
-    date_layer_create(DATE_FRAME, window);
+    // The weather fonts and icons are only loaded once there is weather to show.
+    // The debug and battery layers only take their frames here, their layers are
+    // created the first time the config turns them on.
     weather_layer_create(WEATHER_FRAME, window);
-    // TODO: only create the debug layer when requested
     debug_layer_create(DEBUG_FRAME, window);
-    // TODO: only create the battery layer when requested
     battery_layer_create(BATTERY_FRAME, window);
-    // TODO: only create the bluetooth layer (shows bt connection) when requested
-    
+
     load_persisted_values(weather_data);
     
-    // Kickoff our weather loading 'dot' animation
-    weather_animate(weather_data);
+    // Show the last weather right away, it is only requested again once it is due
+    if (load_weather_values(weather_data))
+    {
+        weather_layer_update(weather_data);
+    }
     
-    // Setup a timer incase we miss or don't receive js_ready to manually try ourselves
-    initial_jsready_timer = app_timer_register(MAX_JS_READY_WAIT,
-                                               initial_jsready_callback, NULL);
+    // Follow the battery, once the battery layer and the weather are set up
+    power_init(handle_power_mode);
     
-    // Update the screen right away
-    time_t now = time(NULL);
-    handle_tick(localtime(&now), MINUTE_UNIT | DAY_UNIT );
+    // Kickoff our weather loading 'dot' animation
+    weather_animate(weather_data);
     
-    // And then every minute
+    // Update the screen every minute
     tick_timer_service_subscribe(MINUTE_UNIT, handle_tick);
     
     // Subscribe to Bluetooth updates
+    bt_connected = bluetooth_connection_service_peek();
     bluetooth_connection_service_subscribe(handle_bt_event);
+    
+    metrics_sample_heap();
+    uint32_t heap_used = heap_bytes_used();
+    LOG_INFO("startup: event loop start %dms, ready %dms, heap %d bytes",
+             (int)loop_start_ms, (int)(latency_now_ms() - init_started_ms), (int)heap_used);
+    event_log(EVENT_STARTUP, heap_used / 1024, loop_start_ms > INT16_MAX ? INT16_MAX : loop_start_ms);
+}
+
+/**
+ * Initialize, only the clock is set up before the event loop starts
+ */
+static void init(void)
+{
+    LOG_DEBUG("init started");
+    init_started_ms = latency_now_ms();
+    
+    window = window_create();
+    window_stack_push(window, true /* Animated */);
+    window_set_background_color(window, GColorBlack);
+    
+    time_layer_create(TIME_FRAME, window);
+    date_layer_create(DATE_FRAME, window);
+    
+    // Show the time right away
+    time_t now = time(NULL);
+    time_layer_update();
+    date_layer_update(localtime(&now));
+    
+    // The rest waits until the event loop is running
+    startup_timer = app_timer_register(0, startup_callback, NULL);
 }
 
 /**
@@ -156,9 +332,25 @@ static void init(void)
  */
 static void deinit(void)
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "deinit started");
+    LOG_DEBUG("deinit started");
+    
+    // Closed before the startup finished, only the clock is there
+    if (startup_timer)
+    {
+        app_timer_cancel(startup_timer);
+        window_destroy(window);
+        time_layer_destroy();
+        date_layer_destroy();
+        return;
+    }
     
     tick_timer_service_unsubscribe();
+    bluetooth_connection_service_unsubscribe();
+    power_deinit();
+    if (bt_timer)
+    {
+        app_timer_cancel(bt_timer);
+    }
     
     window_destroy(window);
     
@@ -171,6 +363,8 @@ static void deinit(void)
     free(weather_data);
     
     close_network();
+    metrics_deinit();
+    event_log_deinit();
 }
 
 /**
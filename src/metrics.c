@@ -0,0 +1,182 @@
+#include <pebble.h>
+#include "network.h"
+#include "config.h"
+#include "metrics.h"
+
+/* Bumped whenever Metric changes, older persisted values are discarded */
+#define METRICS_VERSION 4
+
+/* Minutes between writes of changed metrics to persistent storage */
+#define METRICS_PERSIST_INTERVAL 15
+
+typedef struct {
+  uint8_t  version;
+  uint32_t values[METRIC_COUNT];
+} MetricsRecord;
+
+static MetricsRecord metrics;
+static bool metrics_dirty = false;
+static int  minutes_since_persist = 0;
+
+/**
+ * Write the metrics to persistent storage if they changed
+ */
+static void metrics_persist()
+{
+    if ( !metrics_dirty )
+    {
+        return;
+    }
+    persist_write_data(KEY_METRICS_RECORD, &metrics, sizeof(metrics));
+    metrics_dirty = false;
+    minutes_since_persist = 0;
+}
+
+/**
+ * Restore the metrics persisted by an earlier launch
+ */
+void metrics_init()
+{
+    if ( !persist_exists(KEY_METRICS_RECORD) ||
+         persist_read_data(KEY_METRICS_RECORD, &metrics, sizeof(metrics)) != (int)sizeof(metrics) ||
+         metrics.version != METRICS_VERSION )
+    {
+        memset(&metrics, 0, sizeof(metrics));
+        metrics.version = METRICS_VERSION;
+    }
+    metrics_dirty = false;
+    minutes_since_persist = 0;
+}
+
+/**
+ * Persist what changed since the last periodic write
+ */
+void metrics_deinit()
+{
+    metrics_persist();
+}
+
+/**
+ * Increment a counter
+ */
+void metrics_count( Metric metric )
+{
+    metrics_add(metric, 1);
+}
+
+/**
+ * Add to a counter
+ */
+void metrics_add( Metric metric, uint32_t amount )
+{
+    metrics.values[metric] += amount;
+    metrics_dirty = true;
+}
+
+/**
+ * Count an outbox failure by its reason
+ */
+void metrics_outbox_failed( AppMessageResult reason )
+{
+    switch ( reason )
+    {
+        case APP_MSG_SEND_TIMEOUT:  metrics_count(METRIC_FAIL_TIMEOUT);       break;
+        case APP_MSG_SEND_REJECTED: metrics_count(METRIC_FAIL_REJECTED);      break;
+        case APP_MSG_NOT_CONNECTED: metrics_count(METRIC_FAIL_NOT_CONNECTED); break;
+        case APP_MSG_BUSY:          metrics_count(METRIC_FAIL_BUSY);          break;
+        default:                    metrics_count(METRIC_FAIL_OTHER);         break;
+    }
+}
+
+/**
+ * Raise the heap high-water mark to the current usage
+ */
+void metrics_sample_heap()
+{
+    uint32_t used = heap_bytes_used();
+    if ( used > metrics.values[METRIC_HEAP_PEAK] )
+    {
+        metrics.values[METRIC_HEAP_PEAK] = used;
+        metrics_dirty = true;
+    }
+}
+
+/**
+ * Called on every minute tick, counts the wakeup and persists the metrics every
+ * METRICS_PERSIST_INTERVAL minutes
+ */
+void metrics_minute_tick()
+{
+    metrics_count(METRIC_WAKEUPS);
+    metrics_sample_heap();
+    
+    if ( ++minutes_since_persist >= METRICS_PERSIST_INTERVAL )
+    {
+        metrics_persist();
+    }
+}
+
+/**
+ * Number of debug pages the metrics fill
+ */
+int metrics_page_count()
+{
+    return 4;
+}
+
+/**
+ * Format one debug page of the metrics
+ */
+void metrics_format_page( int page, char *buffer, size_t size )
+{
+    uint32_t *v = metrics.values;
+    switch ( page )
+    {
+        case 0:
+        {
+            snprintf(buffer, size, "req%u rty%u drp%u rdr%u",
+                     (unsigned int)v[METRIC_REQUESTS], (unsigned int)v[METRIC_RETRIES],
+                     (unsigned int)v[METRIC_DROPS], (unsigned int)v[METRIC_REDRAWS]);
+            break;
+        }
+        case 1:
+        {
+            snprintf(buffer, size, "wk%u in%uk hp%u fl%u",
+                     (unsigned int)v[METRIC_WAKEUPS], (unsigned int)(v[METRIC_BYTES_IN] / 1024),
+                     (unsigned int)v[METRIC_HEAP_PEAK], (unsigned int)v[METRIC_BT_FLAPS]);
+            break;
+        }
+        case 2:
+        {
+            snprintf(buffer, size, "R mg%u to%u sn%us",
+                     (unsigned int)v[METRIC_MERGED], (unsigned int)v[METRIC_REQUEST_TIMEOUTS],
+                     (unsigned int)(v[METRIC_SNIFF_REDUCED_MS] / 1000));
+            break;
+        }
+        default:
+        {
+            snprintf(buffer, size, "F to%u rj%u nc%u bs%u ot%u",
+                     (unsigned int)v[METRIC_FAIL_TIMEOUT], (unsigned int)v[METRIC_FAIL_REJECTED],
+                     (unsigned int)v[METRIC_FAIL_NOT_CONNECTED], (unsigned int)v[METRIC_FAIL_BUSY],
+                     (unsigned int)v[METRIC_FAIL_OTHER]);
+            break;
+        }
+    }
+}
+
+/**
+ * Add the metrics to a message for the phone, which logs them. The values are sent
+ * as little endian 32 bit values in Metric order.
+ */
+void metrics_write( DictionaryIterator *iter )
+{
+    uint8_t data[METRIC_COUNT * 4];
+    for ( int i = 0; i < METRIC_COUNT; i++ )
+    {
+        data[4 * i]     = metrics.values[i] & 0xFF;
+        data[4 * i + 1] = (metrics.values[i] >> 8) & 0xFF;
+        data[4 * i + 2] = (metrics.values[i] >> 16) & 0xFF;
+        data[4 * i + 3] = (metrics.values[i] >> 24) & 0xFF;
+    }
+    dict_write_data(iter, KEY_METRICS, data, sizeof(data));
+}
@@ -0,0 +1,36 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/* Counters, in the order they are dumped to the phone, see METRIC_NAMES in pebble-js-app.js */
+typedef enum {
+  METRIC_REQUESTS = 0,      // weather requests sent
+  METRIC_RETRIES,           // requests resent after an outbox failure or a timeout
+  METRIC_DROPS,             // inbound messages dropped
+  METRIC_REDRAWS,           // weather layer redraws
+  METRIC_WAKEUPS,           // tick and timer wakeups
+  METRIC_BYTES_IN,          // bytes received from the phone
+  METRIC_FAIL_TIMEOUT,      // outbox failures by AppMessageResult
+  METRIC_FAIL_REJECTED,
+  METRIC_FAIL_NOT_CONNECTED,
+  METRIC_FAIL_BUSY,
+  METRIC_FAIL_OTHER,
+  METRIC_HEAP_PEAK,         // gauge, heap high-water mark in bytes
+  METRIC_BT_FLAPS,          // Bluetooth drops shorter than the grace period
+  METRIC_MERGED,            // weather requests merged into the pending one
+  METRIC_REQUEST_TIMEOUTS,  // weather requests the phone did not answer in time
+  METRIC_SNIFF_REDUCED_MS,  // time spent with the reduced Bluetooth sniff interval
+  METRIC_COUNT
+} Metric;
+
+void metrics_init();
+void metrics_deinit();
+void metrics_count( Metric metric );
+void metrics_add( Metric metric, uint32_t amount );
+void metrics_outbox_failed( AppMessageResult reason );
+void metrics_sample_heap();
+void metrics_minute_tick();
+int  metrics_page_count();
+void metrics_format_page( int page, char *buffer, size_t size );
+void metrics_write( DictionaryIterator *iter );
+
+#endif
@@ -5,139 +5,471 @@
 #include "debug_layer.h"
 #include "main.h"
 #include "persist.h"
+#include "latency.h"
+#include "metrics.h"
+#include "event_log.h"
+#include "log.h"
+#include "power.h"
 
 const  int MAX_RETRY = 2;
 static int retry_count = 0;
 
+/* Need to wait for JS to be ready */
+const  int MAX_JS_READY_WAIT = 5000; // 5s
+/* A request unanswered this long is resent. Covers the phone's worst case: a 30s
+   location fix, a 20s fetch from each of two providers and 3 acks of 10s. The phone
+   re-arms it by reporting a resend it is still working on. */
+const  int REQUEST_TIMEOUT = 120000; // 2 mins
+/* Wait before the first resend, doubled for each further one */
+const  int RETRY_BACKOFF = 2000; // 2s
+
+/*
+ * Weather requests go through a small state machine, at most one request is in
+ * flight and triggers arriving in the meantime are merged into it
+ */
+typedef enum {
+    REQUEST_IDLE = 0,
+    REQUEST_AWAITING_JS, // wanted before the phone's JavaScript is ready
+    REQUEST_IN_FLIGHT,   // sent, waiting for the answer
+    REQUEST_BACKOFF      // failed, waiting to resend
+} RequestState;
+
+static RequestState request_state = REQUEST_IDLE;
+static AppTimer *request_timer = NULL;
+static bool js_waiting = true;
+static AppTimer *js_wait_timer = NULL;
+
+/*
+ * The Bluetooth sniff interval is reduced while an exchange with the phone is under
+ * way, compare with ./waf configure --exchange-sniff=normal
+ */
+#ifndef EXCHANGE_SNIFF_REDUCED
+#define EXCHANGE_SNIFF_REDUCED 1
+#endif
+static bool sniff_reduced = false;
+static uint32_t sniff_reduced_since = 0;
+
+/* True once the phone has acknowledged a request carrying our full configuration */
+static bool config_synced = false;
+
+/* Id of the last weather request, the phone echoes it with the duration of its stages */
+static uint16_t req_id = 0;
+
+/* The phone asked for the diagnostics, sent once the outbox is free */
+const  int DIAGNOSTICS_DELAY = 100; // 100ms
+static bool diagnostics_pending = false;
+static AppTimer *diagnostics_timer = NULL;
+
 /**
- * Process the event which contains the current weather data
+ * Summarize the configuration the phone needs to know about, see configVersion() in
+ * pebble-js-app.js
  */
-bool processCurrentWeather( DictionaryIterator* received, WeatherData *weather )
+static uint16_t config_version( WeatherData *weather )
 {
-    Tuple* tuple = dict_read_first( received );
-    // while we have tuples and regognize keys
-    while ( tuple )
+    return (CONFIG_FORMAT << 8) |
+        (strcmp(weather->service, SERVICE_OPEN_WEATHER) == 0 ? 1 << 0 : 0) |
+        (strcmp(weather->scale, SCALE_CELSIUS) == 0          ? 1 << 1 : 0) |
+        (weather->debug                                      ? 1 << 2 : 0) |
+        (weather->battery                                    ? 1 << 3 : 0);
+}
+
+/**
+ * Map a weather message key to its bit in the KEY_CHANGED mask
+ *
+ * \return The WeatherField bit, 0 for keys which are not weather fields
+ */
+static uint32_t weather_field_for_key( uint32_t key )
+{
+    switch ( key )
     {
-        switch ( tuple->key )
-        {
-            case KEY_TEMPERATURE:
-            {
-                weather->temperature = tuple->value->int32;
-                break;
-            }
-            case KEY_CONDITION:
-            {
-                weather->condition   = tuple->value->int32;
-                break;
-            }
-            case KEY_SUNRISE:
-            {
-                weather->sunrise     = tuple->value->int32;
-                break;
-            }
-            case KEY_SUNSET:
-            {
-                weather->sunset      = tuple->value->int32;
-                break;
-            }
-            case KEY_PUB_DATE:
-            {
-                strncpy(weather->pub_date, tuple->value->cstring, 6);
-                break;
-            }
-            case KEY_LOCALE:
-            {
-                strncpy(weather->locale, tuple->value->cstring, 255);
-                break;
-            }
-            case KEY_TZOFFSET:
-            {
-                weather->tzoffset    = tuple->value->int32;
-                break;
-            }
-            default:
-            {
-                return false;
-            }
-        } // switch
-        tuple = dict_read_next( received );
-    } // while
+        case KEY_TEMPERATURE: return WEATHER_F_TEMPERATURE;
+        case KEY_CONDITION:   return WEATHER_F_CONDITION;
+        case KEY_SUNRISE:     return WEATHER_F_SUNRISE;
+        case KEY_SUNSET:      return WEATHER_F_SUNSET;
+        case KEY_PUB_DATE:    return WEATHER_F_PUB_DATE;
+        case KEY_TZOFFSET:    return WEATHER_F_TZOFFSET;
+        case KEY_LOCALE:      return WEATHER_F_LOCALE;
+        case KEY_H1_TEMP:     return WEATHER_F_H1_TEMP;
+        case KEY_H1_COND:     return WEATHER_F_H1_COND;
+        case KEY_H1_TIME:     return WEATHER_F_H1_TIME;
+        case KEY_H1_POP:      return WEATHER_F_H1_POP;
+        case KEY_H2_TEMP:     return WEATHER_F_H2_TEMP;
+        case KEY_H2_COND:     return WEATHER_F_H2_COND;
+        case KEY_H2_TIME:     return WEATHER_F_H2_TIME;
+        case KEY_H2_POP:      return WEATHER_F_H2_POP;
+        case KEY_PROVIDER:    return WEATHER_F_PROVIDER;
+        default:              return 0;
+    }
+}
+
+/**
+ * Send the metrics and the event log to the phone, which decodes them into its log
+ *
+ * \return True if the message was handed to the outbox
+ */
+static bool send_diagnostics()
+{
+    DictionaryIterator *iter = NULL;
+    if ( app_message_outbox_begin(&iter) != APP_MSG_OK || iter == NULL )
+    {
+        return false;
+    }
+    metrics_write(iter);
+    event_log_write(iter);
+    dict_write_end(iter);
     
-    weather->error       = WEATHER_E_OK;
-    weather->updated     = time(NULL);
+    return app_message_outbox_send() == APP_MSG_OK;
+}
+
+/**
+ * Send the diagnostics the phone asked for, unless the outbox is still busy. A busy
+ * outbox reports its message sent later, which tries again.
+ */
+static void flush_diagnostics()
+{
+    if (diagnostics_pending && send_diagnostics())
+    {
+        diagnostics_pending = false;
+    }
+}
+
+/**
+ * The inbox handler which took the phone's ask has returned, the outbox is free
+ * unless another message is under way
+ */
+static void diagnostics_callback( void *context )
+{
+    diagnostics_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
+    flush_diagnostics();
+}
+
+/**
+ * Reduce the sniff interval while waiting for js_ready or for the answer to a
+ * request, messages then cross the link without waiting for the next sniff anchor.
+ * Back to normal as soon as the exchange is over.
+ */
+static void update_sniff_interval()
+{
+    bool reduced = EXCHANGE_SNIFF_REDUCED && (js_waiting || request_state == REQUEST_IN_FLIGHT);
+    if (reduced == sniff_reduced)
+    {
+        return;
+    }
+    sniff_reduced = reduced;
+    if (reduced)
+    {
+        sniff_reduced_since = latency_now_ms();
+    }
+    else
+    {
+        metrics_add(METRIC_SNIFF_REDUCED_MS, latency_now_ms() - sniff_reduced_since);
+    }
+    app_comm_set_sniff_interval(reduced ? SNIFF_INTERVAL_REDUCED : SNIFF_INTERVAL_NORMAL);
+}
+
+/**
+ * Cancel the timeout or backoff timer of the current request
+ */
+static void request_cancel_timer()
+{
+    if ( request_timer )
+    {
+        app_timer_cancel(request_timer);
+        request_timer = NULL;
+    }
+}
+
+/**
+ * The request was answered, or there is no point in resending it
+ */
+static void request_complete()
+{
+    request_cancel_timer();
+    request_state = REQUEST_IDLE;
+    retry_count = 0;
+    update_sniff_interval();
+}
+
+static bool send_request( WeatherData *weather_data );
+
+/**
+ * The backoff is over, resend the request
+ */
+static void request_backoff_callback( void *context )
+{
+    request_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
     
-    if (weather->debug)
+    WeatherData *weather_data = (WeatherData*) context;
+    request_state = REQUEST_IDLE;
+    if (!bluetooth_connection_service_peek())
     {
-        debug_enable_display();
-        debug_update_weather(weather);
+        // the reconnect triggers a new request
+        weather_data->error = WEATHER_E_DISCONNECTED;
+        request_complete();
+        return;
     }
+    send_request(weather_data);
+}
+
+/**
+ * Resend the request after a backoff, or give up after MAX_RETRY resends
+ */
+static void request_retry( WeatherData *weather_data )
+{
+    request_cancel_timer();
+    if (retry_count >= MAX_RETRY)
+    {
+        LOG_DEBUG("Too many retries");
+        // only now the user is told, a resend usually gets through
+        weather_data->error = WEATHER_E_PHONE;
+        request_complete();
+        return;
+    }
+    metrics_count(METRIC_RETRIES);
+    request_state = REQUEST_BACKOFF;
+    request_timer = app_timer_register(RETRY_BACKOFF << retry_count, request_backoff_callback,
+                                       weather_data);
+    retry_count++;
+    update_sniff_interval();
+}
+
+/**
+ * The phone did not answer the request in time
+ */
+static void request_timeout_callback( void *context )
+{
+    request_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
     
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Weather temp:%i cond:%i pd:%s tzos:%i loc:%s",
-            weather->temperature, weather->condition, weather->pub_date,
-            weather->tzoffset, weather->locale);
-    return true;
+    WeatherData *weather_data = (WeatherData*) context;
+    LOG_DEBUG("Request %u timed out", (unsigned int)req_id);
+    metrics_count(METRIC_REQUEST_TIMEOUTS);
+    request_retry(weather_data);
 }
 
 /**
- * Process the event which contains the hourly weather data
+ * The phone's JavaScript is ready, or did not say so within MAX_JS_READY_WAIT. Sends
+ * the request parked while waiting.
  */
-bool processHourlyWeather( DictionaryIterator* received, WeatherData *weather )
+static void js_ready_reached( WeatherData *weather_data )
 {
-    Tuple* tuple = dict_read_first( received );
-    while ( tuple )
+    js_waiting = false;
+    if (js_wait_timer)
     {
-        switch ( tuple->key )
+        app_timer_cancel(js_wait_timer);
+        js_wait_timer = NULL;
+    }
+    update_sniff_interval();
+    
+    // A request sent before a new JavaScript context started was lost with the old one
+    if (request_state == REQUEST_IN_FLIGHT)
+    {
+        request_complete();
+    }
+    
+    initial_jsready_callback();
+    
+    if (request_state == REQUEST_AWAITING_JS)
+    {
+        request_state = REQUEST_IDLE;
+        send_request(weather_data);
+    }
+}
+
+/**
+ * Stop waiting for js_ready, try ourselves
+ */
+static void js_wait_callback( void *context )
+{
+    js_wait_timer = NULL;
+    metrics_count(METRIC_WAKEUPS);
+    js_ready_reached((WeatherData*) context);
+}
+
+/**
+ * Process a tuple which contains a current weather field
+ *
+ * \return True if the tuple was a current weather field, false otherwise
+ */
+static bool processCurrentWeather( Tuple* tuple, WeatherData *weather )
+{
+    switch ( tuple->key )
+    {
+        case KEY_TEMPERATURE:
         {
-            case KEY_H1_TEMP:
-            {
-                weather->h1_temp = tuple->value->int32;
-                break;
-            }
-            case KEY_H1_COND:
-            {
-                weather->h1_cond = tuple->value->int32;
-                break;
-            }
-            case KEY_H1_TIME:
-            {
-                weather->h1_time = tuple->value->int32;
-                break;
-            }
-            case KEY_H1_POP:
-            {
-                weather->h1_pop  = tuple->value->int32;
-                break;
-            }
-            case KEY_H2_TEMP:
-            {
-                weather->h2_temp = tuple->value->int32;
-                break;
-            }
-            case KEY_H2_COND:
-            {
-                weather->h2_cond = tuple->value->int32;
-                break;
-            }
-            case KEY_H2_TIME:
-            {
-                weather->h2_time = tuple->value->int32;
-                break;
-            }
-            case KEY_H2_POP:
+            weather->temperature = tuple->value->int32;
+            break;
+        }
+        case KEY_CONDITION:
+        {
+            weather->condition   = tuple->value->int32;
+            break;
+        }
+        case KEY_SUNRISE:
+        {
+            weather->sunrise     = tuple->value->int32;
+            break;
+        }
+        case KEY_SUNSET:
+        {
+            weather->sunset      = tuple->value->int32;
+            break;
+        }
+        case KEY_PUB_DATE:
+        {
+            strncpy(weather->pub_date, tuple->value->cstring, 6);
+            break;
+        }
+        case KEY_LOCALE:
+        {
+            strncpy(weather->locale, tuple->value->cstring, 255);
+            break;
+        }
+        case KEY_TZOFFSET:
+        {
+            weather->tzoffset    = tuple->value->int32;
+            break;
+        }
+        case KEY_PROVIDER:
+        {
+            // Only providers with an icon mapping are kept, the configured service
+            // is used for the icons otherwise
+            const char *provider = tuple->value->cstring;
+            if ( strcmp(provider, SERVICE_OPEN_WEATHER) != 0 &&
+                 strcmp(provider, SERVICE_YAHOO_WEATHER) != 0 &&
+                 strcmp(provider, SERVICE_WUNDER_WEATHER) != 0 )
             {
-                weather->h2_pop  = tuple->value->int32;
+                LOG_DEBUG("Unknown provider dropped");
+                weather->provider[0] = '\0';
                 break;
             }
-            default:
+            strncpy(weather->provider, provider, sizeof(weather->provider) - 1);
+            weather->provider[sizeof(weather->provider) - 1] = '\0';
+            break;
+        }
+        default:
+        {
+            return false;
+        }
+    } // switch
+    return true;
+}
+
+/**
+ * Process a tuple which contains an hourly weather field
+ *
+ * \return True if the tuple was an hourly weather field, false otherwise
+ */
+static bool processHourlyWeather( Tuple* tuple, WeatherData *weather )
+{
+    switch ( tuple->key )
+    {
+        case KEY_H1_TEMP:
+        {
+            weather->h1_temp = tuple->value->int32;
+            break;
+        }
+        case KEY_H1_COND:
+        {
+            weather->h1_cond = tuple->value->int32;
+            break;
+        }
+        case KEY_H1_TIME:
+        {
+            weather->h1_time = tuple->value->int32;
+            break;
+        }
+        case KEY_H1_POP:
+        {
+            weather->h1_pop  = tuple->value->int32;
+            break;
+        }
+        case KEY_H2_TEMP:
+        {
+            weather->h2_temp = tuple->value->int32;
+            break;
+        }
+        case KEY_H2_COND:
+        {
+            weather->h2_cond = tuple->value->int32;
+            break;
+        }
+        case KEY_H2_TIME:
+        {
+            weather->h2_time = tuple->value->int32;
+            break;
+        }
+        case KEY_H2_POP:
+        {
+            weather->h2_pop  = tuple->value->int32;
+            break;
+        }
+        default:
+        {
+            return false;
+        }
+    } // switch
+    return true;
+}
+
+/**
+ * Process a weather update. Updates carry a sequence number and a mask of the
+ * fields which changed since the last update the phone saw acknowledged; only
+ * those fields are applied. Updates older than the last one applied are dropped.
+ * A record the phone restored from its cache carries its age in seconds.
+ *
+ * \return True if the update was applied, false if it was out of order
+ */
+bool processWeatherUpdate( DictionaryIterator* received, int32_t seq, WeatherData *weather )
+{
+    if ( weather->seq != 0 && seq <= weather->seq )
+    {
+        LOG_DEBUG("Weather seq:%i dropped, last:%i", (int)seq, (int)weather->seq);
+        event_log(EVENT_WEATHER_DROPPED, seq, weather->seq);
+        return false;
+    }
+    weather->seq = seq;
+
+    Tuple* changed_tuple = dict_find( received, KEY_CHANGED );
+    uint32_t changed = changed_tuple ? changed_tuple->value->uint32 : 0;
+
+    Tuple* tuple = dict_read_first( received );
+    while ( tuple )
+    {
+        if ( changed & weather_field_for_key( tuple->key ) )
+        {
+            if ( !processCurrentWeather( tuple, weather ) )
             {
-                return false;
+                processHourlyWeather( tuple, weather );
             }
-        } // switch
+        }
         tuple = dict_read_next( received );
     } // while
     
-    weather->hourly_enabled = true;
-    weather->hourly_updated = time(NULL);
+    // Records restored from the phone's cache say how long ago they were fetched
+    Tuple* age = dict_find( received, KEY_AGE );
+    
+    weather->error       = WEATHER_E_OK;
+    weather->updated     = time(NULL) - (age ? age->value->int32 : 0);
+    
+    if ( changed & WEATHER_F_HOURLY )
+    {
+        weather->hourly_enabled = true;
+        weather->hourly_updated = weather->updated;
+    }
+    
+    if (weather->debug)
+    {
+        debug_enable_display();
+        debug_update_weather(weather);
+    }
+    
+    event_log(EVENT_WEATHER, seq, weather->temperature);
+    LOG_DEBUG("Weather seq:%i chg:%x temp:%i cond:%i pd:%s tzos:%i loc:%s",
+              (int)seq, (unsigned int)changed, weather->temperature, weather->condition,
+              weather->pub_date, weather->tzoffset, weather->locale);
     return true;
 }
 
@@ -187,8 +519,9 @@ bool processConfigSettings( DictionaryIterator* received, WeatherData *weather )
         tuple = dict_read_next( received );
     } // while
     
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Configuration serv:%s scale:%s debug:%i batt:%i",
-            weather->service, weather->scale, weather->debug, weather->battery);
+    event_log(EVENT_CONFIG, 0, config_version(weather));
+    LOG_DEBUG("Configuration serv:%s scale:%s debug:%i batt:%i",
+              weather->service, weather->scale, weather->debug, weather->battery);
     
     if (weather->battery)
     {
@@ -218,16 +551,62 @@ bool processConfigSettings( DictionaryIterator* received, WeatherData *weather )
  */
 static void appmsg_in_received( DictionaryIterator *received, void *context )
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "In received.");
+    LOG_DEBUG("In received.");
     
     WeatherData *weather = (WeatherData*) context;
+    bool handled = false;
+    bool redraw  = true;
+    bool store   = false;
+    
+    metrics_add(METRIC_BYTES_IN, dict_size(received));
+    
+    // The phone suggests when its provider will have published new data
+    Tuple* next_fetch = dict_find( received, KEY_NEXT_FETCH );
+    if ( next_fetch )
+    {
+        weather->next_fetch = next_fetch->value->int32;
+        store = true;
+    }
+    
+    // The response to a request reports how long the phone spent on it
+    Tuple* span = dict_find( received, KEY_REQ_ID );
+    if ( span )
+    {
+        Tuple* stages = dict_find( received, KEY_STAGES );
+        latency_response_received( span->value->uint16, stages ? stages->value->data : NULL,
+                                   stages ? stages->length : 0 );
+    }
+    
+    // The phone is still working on an earlier request, give it another timeout
+    Tuple* in_progress = dict_find( received, KEY_IN_PROGRESS );
+    if ( in_progress && request_state == REQUEST_IN_FLIGHT && in_progress->value->uint16 == req_id )
+    {
+        LOG_DEBUG("Request %u in progress on the phone", (unsigned int)req_id);
+        request_cancel_timer();
+        request_timer = app_timer_register(REQUEST_TIMEOUT, request_timeout_callback, weather);
+    }
+    
+    // Weather updates carry a sequence number, late retries are dropped without a redraw
+    Tuple* seq = dict_find( received, KEY_SEQ );
     
-    // Process the current weather
-    bool handled = processCurrentWeather( received, context );
-    // try to process hourly weather (wunder provides it all in one message)
-    handled = ( processHourlyWeather( received, context ) ) ? true : handled;
-    // if the message wasn't handled, process updated configuration settings
-    handled = (handled) ? handled : processConfigSettings( received, context );
+    // The request is answered by its echo, or by any weather or error from the phone,
+    // a late answer also cancels a pending resend
+    if ( (request_state == REQUEST_IN_FLIGHT || request_state == REQUEST_BACKOFF) &&
+         ( (span && span->value->uint16 == req_id) || seq || dict_find( received, KEY_ERROR ) ) )
+    {
+        request_complete();
+    }
+    if ( seq )
+    {
+        handled = true;
+        redraw  = processWeatherUpdate( received, seq->value->int32, weather );
+        store   = store || redraw;
+    }
+    else
+    {
+        // process updated configuration settings
+        handled = processConfigSettings( received, context );
+    }
 
     // if the message wasn't handled, handle any other message
     if ( !handled )
@@ -241,35 +620,98 @@ static void appmsg_in_received( DictionaryIterator *received, void *context )
                 case KEY_ERROR:
                 {
                     weather->error   = WEATHER_E_NETWORK;
-                    APP_LOG(APP_LOG_LEVEL_DEBUG, "Error: %s", tuple->value->cstring);
+                    event_log(EVENT_PHONE_ERROR, 0, 0);
+                    LOG_DEBUG("Error: %s", tuple->value->cstring);
                     break;
                 }
                 case KEY_JS_READY:
                 {
                     weather->js_ready = true;
                     weather->error    = WEATHER_E_OK;
-                    APP_LOG(APP_LOG_LEVEL_DEBUG, "Javascript is ready");
+                    // a new javascript context starts counting weather updates over,
+                    // and needs to learn our configuration again
+                    weather->seq      = 0;
+                    config_synced     = false;
+                    event_log(EVENT_JS_READY, 0, 0);
+                    LOG_DEBUG("Javascript is ready");
                     debug_update_message("JS ready");
-                    initial_jsready_callback();
+                    js_ready_reached(weather);
+                    break;
+                }
+                case KEY_FETCH_OFFSET:
+                {
+                    // Minutes this device's refreshes are moved by, spreads the fleet out
+                    weather->fetch_offset = tuple->value->int32;
+                    break;
+                }
+                case KEY_METRICS:
+                {
+                    // The phone asks for our metrics and event log to log them, the
+                    // outbox is busy acknowledging its message until we return
+                    diagnostics_pending = true;
+                    if (!diagnostics_timer)
+                    {
+                        diagnostics_timer = app_timer_register(DIAGNOSTICS_DELAY,
+                                                               diagnostics_callback, NULL);
+                    }
+                    redraw = false;
+                    break;
+                }
+                case KEY_IN_PROGRESS:
+                {
+                    // already handled, nothing to redraw
+                    redraw = false;
+                    break;
+                }
+                case KEY_REQ_ID:
+                case KEY_STAGES:
+                {
+                    // already handled, closes the latency span
+                    break;
+                }
+                case KEY_NEXT_FETCH:
+                {
+                    // nothing changed on the phone except the schedule
+                    redraw = false;
+                    break;
+                }
+                case KEY_CONFIG_VERSION:
+                {
+                    // The phone does not know our configuration, resend the request with it
+                    if ( tuple->value->uint16 != config_version( weather ) )
+                    {
+                        LOG_DEBUG("Config version mismatch: %x",
+                                  (unsigned int)tuple->value->uint16);
+                        config_synced = false;
+                        request_complete();
+                        request_weather( weather );
+                    }
                     break;
                 }
                 default:
                 {
                     weather->error = WEATHER_E_PHONE;
                     // Unknown key
-                    APP_LOG(APP_LOG_LEVEL_DEBUG, "appmsg_in_received: unknown key: %u",
-                            (unsigned int)tuple->key );
+                    LOG_DEBUG("appmsg_in_received: unknown key: %u",
+                              (unsigned int)tuple->key );
                 }
             } // switch
             tuple = dict_read_next( received );
         } // while
     } // if
     
-    weather_layer_update(weather);
-    // Success! reset the retry count...
-    retry_count = 0;
+    if ( redraw )
+    {
+        weather_layer_update(weather);
+    }
+    // Keep the last weather so the face can show it right away when it is relaunched
+    if ( store && weather->error == WEATHER_E_OK )
+    {
+        store_weather_values(weather);
+    }
 }
 
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
 /**
  * Translate the error code into a human readable value
  */
@@ -309,13 +751,16 @@ static char *translate_error(AppMessageResult result)
         return "UNKNOWN ERROR";
     }
 }
+#endif
 
 /**
  * Handle the callback indicating a message has been dropped
  */
 static void appmsg_in_dropped( AppMessageResult reason, void *context )
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "In dropped: %s", translate_error(reason));
+    LOG_DEBUG("In dropped: %s", translate_error(reason));
+    metrics_count(METRIC_DROPS);
+    event_log(EVENT_IN_DROPPED, 0, reason);
 }
 
 /**
@@ -323,7 +768,14 @@ static void appmsg_in_dropped( AppMessageResult reason, void *context )
  */
 static void appmsg_out_sent( DictionaryIterator *sent, void *context )
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Out sent.");
+    LOG_DEBUG("Out sent.");
+    
+    if ( dict_find( sent, KEY_SERVICE ) )
+    {
+        config_synced = true;
+    }
+    
+    flush_diagnostics();
 }
 
 /**
@@ -334,24 +786,32 @@ static void appmsg_out_failed( DictionaryIterator *failed, AppMessageResult reas
 {
     WeatherData *weather_data = (WeatherData*) context;
     
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Out failed: %s", translate_error(reason));
+    LOG_DEBUG("Out failed: %s", translate_error(reason));
     
-    retry_count++;
+    metrics_outbox_failed(reason);
+    event_log(EVENT_OUT_FAILED, retry_count, reason);
+    
+    // only the failure of the request in flight is resent
+    Tuple* failed_id = dict_find( failed, KEY_REQ_ID );
+    if ( !failed_id || failed_id->value->uint16 != req_id || request_state != REQUEST_IN_FLIGHT )
+    {
+        return;
+    }
     
     switch (reason)
     {
         case APP_MSG_NOT_CONNECTED:
         {
+            // the reconnect triggers a new request
             weather_data->error = WEATHER_E_DISCONNECTED;
-            request_weather(weather_data);
+            request_complete();
             break;
         }
         case APP_MSG_SEND_REJECTED:
         case APP_MSG_SEND_TIMEOUT:
         default:
         {
-            weather_data->error = WEATHER_E_PHONE;
-            request_weather(weather_data);
+            request_retry(weather_data);
             break;
         }
     }
@@ -372,16 +832,28 @@ void init_network( WeatherData *weather_data )
     app_message_set_context(weather_data);
     app_message_open(max_in, max_out);
     
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "AppMessage max_IN: %i, max_OUT: %i", max_in, max_out);
+    LOG_DEBUG("AppMessage max_IN: %i, max_OUT: %i", max_in, max_out);
     
     weather_data->error    = WEATHER_E_OK;
     weather_data->updated  = 0;
     weather_data->js_ready = false;
+    weather_data->seq      = 0;
+    weather_data->provider[0] = '\0';
+    weather_data->next_fetch  = 0;
+    weather_data->fetch_offset = 0;
     
     weather_data->hourly_updated = 0;
     weather_data->hourly_enabled = false;
     
-    retry_count = 0;
+    retry_count   = 0;
+    config_synced = false;
+    
+    // Requests wait for js_ready, or MAX_JS_READY_WAIT before we try ourselves
+    request_state = REQUEST_IDLE;
+    js_waiting    = true;
+    js_wait_timer = app_timer_register(MAX_JS_READY_WAIT, js_wait_callback, weather_data);
+    // reduced until js_ready arrives, the request it releases keeps it reduced
+    update_sniff_interval();
 }
 
 /**
@@ -390,22 +862,45 @@ void init_network( WeatherData *weather_data )
 void close_network()
 {
     app_message_deregister_callbacks();
+    request_cancel_timer();
+    if (js_wait_timer)
+    {
+        app_timer_cancel(js_wait_timer);
+        js_wait_timer = NULL;
+    }
+    if (diagnostics_timer)
+    {
+        app_timer_cancel(diagnostics_timer);
+        diagnostics_timer = NULL;
+    }
+    js_waiting    = false;
+    request_state = REQUEST_IDLE;
+    update_sniff_interval();
 }
 
 /**
- * Send a request to the JavaScript engine to request the weather data
+ * Ask for the weather. Only one request is in flight at a time, asking again
+ * before it is answered is merged into it.
  *
- * \return True on success, false otherwise
+ * \return True if a request is pending, false if none could be sent
  */
 bool request_weather( WeatherData *weather_data )
 {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Request weather, retry: %i", retry_count);
-    
-    if (retry_count > MAX_RETRY)
+    switch (request_state)
     {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Too many retries");
-        retry_count = 0;
-        return false;
+        case REQUEST_AWAITING_JS:
+        case REQUEST_IN_FLIGHT:
+        case REQUEST_BACKOFF:
+        {
+            LOG_DEBUG("Request merged, state: %i", request_state);
+            metrics_count(METRIC_MERGED);
+            return true;
+        }
+        case REQUEST_IDLE:
+        default:
+        {
+            break;
+        }
     }
     
     if (!bluetooth_connection_service_peek())
@@ -413,22 +908,66 @@ bool request_weather( WeatherData *weather_data )
         weather_data->error = WEATHER_E_DISCONNECTED;
         return false;
     }
+    
+    if (js_waiting)
+    {
+        LOG_DEBUG("Request waits for js_ready");
+        request_state = REQUEST_AWAITING_JS;
+        return true;
+    }
+    return send_request(weather_data);
+}
+
+/**
+ * Send a request to the JavaScript engine to request the weather data, a request
+ * the outbox does not take is resent after a backoff
+ *
+ * \return True on success, false otherwise
+ */
+static bool send_request( WeatherData *weather_data )
+{
+    LOG_DEBUG("Request weather, retry: %i", retry_count);
+    
     DictionaryIterator *iter = NULL;
     AppMessageResult result = app_message_outbox_begin(&iter);
     
     if (iter == NULL || result != APP_MSG_OK)
     {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Null iter");
+        LOG_DEBUG("Null iter");
+        request_retry(weather_data);
         return false;
     }
     
-    dict_write_cstring(iter, KEY_SERVICE, weather_data->service);
-    dict_write_cstring(iter, KEY_SCALE, weather_data->scale);
-    dict_write_uint8(iter, KEY_DEBUG, (uint8_t)weather_data->debug);
-    dict_write_uint8(iter, KEY_BATTERY, (uint8_t)weather_data->battery);
+    // The full configuration is only sent until the phone has acknowledged it
+    dict_write_uint16(iter, KEY_CONFIG_VERSION, config_version(weather_data));
+    // Zero means no request, the id skips it when it wraps
+    req_id = req_id == UINT16_MAX ? 1 : req_id + 1;
+    dict_write_uint16(iter, KEY_REQ_ID, req_id);
+    // The hourly forecast is left out to save power
+    dict_write_uint8(iter, KEY_HOURLY_ENABLED, (uint8_t)power_hourly_enabled());
+    if (!config_synced)
+    {
+        dict_write_cstring(iter, KEY_SERVICE, weather_data->service);
+        dict_write_cstring(iter, KEY_SCALE, weather_data->scale);
+        dict_write_uint8(iter, KEY_DEBUG, (uint8_t)weather_data->debug);
+        dict_write_uint8(iter, KEY_BATTERY, (uint8_t)weather_data->battery);
+    }
     
     dict_write_end(iter);
     
     result = app_message_outbox_send();
-    return result == APP_MSG_OK;
+    if (result != APP_MSG_OK)
+    {
+        request_retry(weather_data);
+        return false;
+    }
+    
+    latency_request_sent(req_id);
+    metrics_count(METRIC_REQUESTS);
+    event_log(EVENT_REQUEST, retry_count, (int16_t)req_id);
+    
+    request_state = REQUEST_IN_FLIGHT;
+    request_timer = app_timer_register(REQUEST_TIMEOUT, request_timeout_callback, weather_data);
+    update_sniff_interval();
+    return true;
 }
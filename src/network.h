@@ -22,12 +22,28 @@
 #define KEY_H2_TIME 19
 #define KEY_H2_POP 20
 #define KEY_HOURLY_ENABLED 21
+#define KEY_SEQ 22
+#define KEY_CHANGED 23
+#define KEY_CONFIG_VERSION 24
+#define KEY_PROVIDER 25
+#define KEY_NEXT_FETCH 26
+#define KEY_FETCH_OFFSET 27
+#define KEY_AGE 28
+#define KEY_REQ_ID 29
+#define KEY_STAGES 30
+#define KEY_METRICS 31
+#define KEY_EVENTS 32
+#define KEY_IN_PROGRESS 33
 
 #define SERVICE_OPEN_WEATHER "open"
 #define SERVICE_YAHOO_WEATHER "yahoo"
+#define SERVICE_WUNDER_WEATHER "wunder"
 #define SCALE_FAHRENHEIT "F"
 #define SCALE_CELSIUS "C"
 
+/* Bumped whenever the bits of the config version change, must match pebble-js-app.js */
+#define CONFIG_FORMAT 1
+
 typedef enum {
   WEATHER_E_OK = 0,
   WEATHER_E_DISCONNECTED,
@@ -35,6 +51,31 @@ typedef enum {
   WEATHER_E_NETWORK
 } WeatherError;
 
+/* Bits of KEY_CHANGED, must match WEATHER_FIELDS in pebble-js-app.js */
+typedef enum {
+  WEATHER_F_TEMPERATURE = 1 << 0,
+  WEATHER_F_CONDITION   = 1 << 1,
+  WEATHER_F_SUNRISE     = 1 << 2,
+  WEATHER_F_SUNSET      = 1 << 3,
+  WEATHER_F_PUB_DATE    = 1 << 4,
+  WEATHER_F_TZOFFSET    = 1 << 5,
+  WEATHER_F_LOCALE      = 1 << 6,
+  WEATHER_F_H1_TEMP     = 1 << 7,
+  WEATHER_F_H1_COND     = 1 << 8,
+  WEATHER_F_H1_TIME     = 1 << 9,
+  WEATHER_F_H1_POP      = 1 << 10,
+  WEATHER_F_H2_TEMP     = 1 << 11,
+  WEATHER_F_H2_COND     = 1 << 12,
+  WEATHER_F_H2_TIME     = 1 << 13,
+  WEATHER_F_H2_POP      = 1 << 14,
+  WEATHER_F_PROVIDER    = 1 << 15
+} WeatherField;
+
+#define WEATHER_F_HOURLY (WEATHER_F_H1_TEMP | WEATHER_F_H1_COND | WEATHER_F_H1_TIME | \
+                          WEATHER_F_H1_POP  | WEATHER_F_H2_TEMP | WEATHER_F_H2_COND | \
+                          WEATHER_F_H2_TIME | WEATHER_F_H2_POP)
+
+/* Temperatures are stored in tenths of a degree Celsius, see weather_layer_set_temperature */
 typedef struct {
   int temperature;
   int condition;
@@ -43,6 +84,7 @@ typedef struct {
   char pub_date[6];
   int tzoffset;
   char locale[255];
+  char provider[7];
   
   char service[6];
   char scale[2];
@@ -61,6 +103,9 @@ typedef struct {
   time_t hourly_updated;
 
   bool js_ready; 
+  int32_t seq;
+  time_t next_fetch;
+  int fetch_offset;
   time_t updated;
   WeatherError error;
 } WeatherData;
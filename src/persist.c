@@ -3,6 +3,69 @@
 #include "battery_layer.h"
 #include "config.h"
 #include "persist.h"
+#include "event_log.h"
+#include "log.h"
+
+/* Bumped whenever PersistedSettings changes, older records are migrated or reset */
+#define SETTINGS_RECORD_VERSION 1
+
+/**
+ * The app control values as persisted, in one record so a config change costs at
+ * most one write
+ */
+typedef struct {
+  uint8_t version;
+  bool    debug;
+  bool    battery;
+  char    service[6];
+  char    scale[2];
+} PersistedSettings;
+
+/* What is in flash, writes are skipped when nothing changed. The records are built
+   zeroed, so padding and the bytes after the strings compare equal. */
+static PersistedSettings stored_settings;
+
+static void settings_from_weather( PersistedSettings *record, WeatherData *weather_data )
+{
+  memset(record, 0, sizeof(*record));
+  record->version = SETTINGS_RECORD_VERSION;
+  record->debug   = weather_data->debug;
+  record->battery = weather_data->battery;
+  strncpy(record->service, weather_data->service, sizeof(record->service) - 1);
+  strncpy(record->scale, weather_data->scale, sizeof(record->scale) - 1);
+}
+
+/**
+ * Read the settings kept under separate keys by earlier versions, or the
+ * defaults, and drop the old keys
+ */
+static void migrate_legacy_settings( WeatherData *weather_data )
+{
+  weather_data->debug = persist_exists(KEY_DEBUG_MODE) ? persist_read_bool(KEY_DEBUG_MODE) : DEFAULT_DEBUG_MODE; 
+  weather_data->battery = persist_exists(KEY_DISPLAY_BATTERY) ? persist_read_bool(KEY_DISPLAY_BATTERY) : DEFAULT_DISPLAY_BATTERY; 
+
+  if (persist_exists(KEY_WEATHER_SERVICE)) {
+    persist_read_string(KEY_WEATHER_SERVICE, weather_data->service, sizeof(weather_data->service));
+  } else {
+    strcpy(weather_data->service, DEFAULT_WEATHER_SERVICE);
+  }
+
+  if (persist_exists(KEY_WEATHER_SCALE)) {
+    persist_read_string(KEY_WEATHER_SCALE, weather_data->scale, sizeof(weather_data->scale));
+  } else {
+    strcpy(weather_data->scale, DEFAULT_WEATHER_SCALE);
+  }
+
+  // Only drop the old keys once the record holding them is written
+  memset(&stored_settings, 0, sizeof(stored_settings));
+  store_persisted_values(weather_data);
+  if (stored_settings.version == SETTINGS_RECORD_VERSION) {
+    persist_delete(KEY_DEBUG_MODE);
+    persist_delete(KEY_DISPLAY_BATTERY);
+    persist_delete(KEY_WEATHER_SERVICE);
+    persist_delete(KEY_WEATHER_SCALE);
+  }
+}
 
 /**
  * Must happen after layers are created! 
@@ -12,9 +75,21 @@
  */ 
 void load_persisted_values(WeatherData *weather_data) 
 {
-  // Debug
-  weather_data->debug = persist_exists(KEY_DEBUG_MODE) ? persist_read_bool(KEY_DEBUG_MODE) : DEFAULT_DEBUG_MODE; 
+  PersistedSettings record;
 
+  if (persist_exists(KEY_SETTINGS_RECORD) &&
+      persist_read_data(KEY_SETTINGS_RECORD, &record, sizeof(record)) == (int)sizeof(record) &&
+      record.version == SETTINGS_RECORD_VERSION) {
+    stored_settings = record;
+    weather_data->debug   = record.debug;
+    weather_data->battery = record.battery;
+    memcpy(weather_data->service, record.service, sizeof(record.service));
+    memcpy(weather_data->scale, record.scale, sizeof(record.scale));
+  } else {
+    migrate_legacy_settings(weather_data);
+  }
+
+  // Debug
   if (weather_data->debug) {
     debug_enable_display();
     debug_update_message("Initializing...");
@@ -23,50 +98,114 @@ void load_persisted_values(WeatherData *weather_data)
   }
 
   // Battery
-  weather_data->battery = persist_exists(KEY_DISPLAY_BATTERY) ? persist_read_bool(KEY_DISPLAY_BATTERY) : DEFAULT_DISPLAY_BATTERY; 
-
   if (weather_data->battery) {
     battery_enable_display();
   } else {
     battery_disable_display();
   }
-  
-  // Weather Service
-  if (persist_exists(KEY_WEATHER_SERVICE)) {
-    persist_read_string(KEY_WEATHER_SERVICE, weather_data->service, sizeof(weather_data->service));
-  } else {
-    strcpy(weather_data->service, DEFAULT_WEATHER_SERVICE);
-  }
-
-  // Weather Scale
-  if (persist_exists(KEY_WEATHER_SCALE)) {
-    persist_read_string(KEY_WEATHER_SCALE, weather_data->scale, sizeof(weather_data->scale));
-  } else {
-    strcpy(weather_data->scale, DEFAULT_WEATHER_SCALE);
-  }
 
-  APP_LOG(APP_LOG_LEVEL_DEBUG, "PersistLoad:  d:%d b:%d s:%s u:%s", 
+  LOG_DEBUG("PersistLoad:  d:%d b:%d s:%s u:%s", 
       weather_data->debug, weather_data->battery, weather_data->service, weather_data->scale);
 }
 
 /**
- * Persist weather data and app control values
- *
- * TODO: Add some weather data to this. It would enable the watchface to quickly restore 
- * the last known state when the user bounces from this face to another and back.
+ * Persist app control values, the weather itself is stored by store_weather_values.
+ * Nothing is written when the values did not change.
  */
 void store_persisted_values(WeatherData *weather_data) 
 {
-  persist_write_bool(KEY_DEBUG_MODE, weather_data->debug);
-  persist_write_bool(KEY_DISPLAY_BATTERY, weather_data->battery);
-  persist_write_string(KEY_WEATHER_SERVICE, weather_data->service);
-  persist_write_string(KEY_WEATHER_SCALE, weather_data->scale);
+  PersistedSettings record;
+  settings_from_weather(&record, weather_data);
 
+  if (memcmp(&record, &stored_settings, sizeof(record)) == 0) {
+    LOG_DEBUG("PersistStore: settings unchanged");
+    return;
+  }
+
+  if (persist_write_data(KEY_SETTINGS_RECORD, &record, sizeof(record)) != (int)sizeof(record)) {
+    LOG_DEBUG("PersistStore: settings record failed");
+    event_log(EVENT_PERSIST_FAILED, 1, 0);
+    return;
+  }
+  stored_settings = record;
 
-  APP_LOG(APP_LOG_LEVEL_DEBUG, "PersistStore:  d:%d b:%d s:%s u:%s", 
+  LOG_DEBUG("PersistStore:  d:%d b:%d s:%s u:%s", 
       weather_data->debug, weather_data->battery, weather_data->service, weather_data->scale);
 }
 
+/* Bumped whenever PersistedWeather changes, older records are ignored */
+#define WEATHER_RECORD_VERSION 1
+
+/**
+ * The weather record as persisted, the locale is kept under its own key as a
+ * record holding it would exceed PERSIST_DATA_MAX_LENGTH
+ */
+typedef struct {
+  uint8_t version;
+  int32_t temperature;
+  int32_t condition;
+  int32_t sunrise;
+  int32_t sunset;
+  int32_t tzoffset;
+  char    pub_date[6];
+  char    provider[7];
+  int32_t h1_temp;
+  int32_t h1_cond;
+  int32_t h1_time;
+  int32_t h1_pop;
+  int32_t h2_temp;
+  int32_t h2_cond;
+  int32_t h2_time;
+  int32_t h2_pop;
+  bool    hourly_enabled;
+  int32_t hourly_updated;
+  int32_t updated;
+  int32_t next_fetch;
+} PersistedWeather;
+
+/* As stored_settings. The locale is only remembered by its hash, a copy would cost
+   255 bytes of heap. */
+static PersistedWeather stored_weather;
+static uint32_t stored_locale_hash = 0;
+
+static void weather_record_from( PersistedWeather *record, WeatherData *weather_data )
+{
+    memset(record, 0, sizeof(*record));
+    record->version        = WEATHER_RECORD_VERSION;
+    record->temperature    = weather_data->temperature;
+    record->condition      = weather_data->condition;
+    record->sunrise        = weather_data->sunrise;
+    record->sunset         = weather_data->sunset;
+    record->tzoffset       = weather_data->tzoffset;
+    memcpy(record->pub_date, weather_data->pub_date, sizeof(record->pub_date));
+    memcpy(record->provider, weather_data->provider, sizeof(record->provider));
+    record->h1_temp        = weather_data->h1_temp;
+    record->h1_cond        = weather_data->h1_cond;
+    record->h1_time        = weather_data->h1_time;
+    record->h1_pop         = weather_data->h1_pop;
+    record->h2_temp        = weather_data->h2_temp;
+    record->h2_cond        = weather_data->h2_cond;
+    record->h2_time        = weather_data->h2_time;
+    record->h2_pop         = weather_data->h2_pop;
+    record->hourly_enabled = weather_data->hourly_enabled;
+    record->hourly_updated = weather_data->hourly_updated;
+    record->updated        = weather_data->updated;
+    record->next_fetch     = weather_data->next_fetch;
+}
+
+/**
+ * 32 bit FNV-1a hash of a string, 0 is kept for nothing stored
+ */
+static uint32_t locale_hash( const char *locale )
+{
+    uint32_t hash = 2166136261u;
+    while (*locale)
+    {
+        hash = (hash ^ (uint8_t)*locale++) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
 /**
  * Load persisted weather data values. The app can then decide if it is current enough 
  * to defer a weather data request.
@@ -75,18 +214,85 @@ void store_persisted_values(WeatherData *weather_data)
  */
 bool load_weather_values( WeatherData* weather_data )
 {
-    return false;
+    PersistedWeather record;
+    
+    if ( !persist_exists(KEY_WEATHER_RECORD) ||
+         persist_read_data(KEY_WEATHER_RECORD, &record, sizeof(record)) != (int)sizeof(record) ||
+         record.version != WEATHER_RECORD_VERSION )
+    {
+        return false;
+    }
+    stored_weather = record;
+    
+    weather_data->temperature    = record.temperature;
+    weather_data->condition      = record.condition;
+    weather_data->sunrise        = record.sunrise;
+    weather_data->sunset         = record.sunset;
+    weather_data->tzoffset       = record.tzoffset;
+    memcpy(weather_data->pub_date, record.pub_date, sizeof(record.pub_date));
+    memcpy(weather_data->provider, record.provider, sizeof(record.provider));
+    weather_data->provider[sizeof(weather_data->provider) - 1] = '\0';
+    weather_data->h1_temp        = record.h1_temp;
+    weather_data->h1_cond        = record.h1_cond;
+    weather_data->h1_time        = record.h1_time;
+    weather_data->h1_pop         = record.h1_pop;
+    weather_data->h2_temp        = record.h2_temp;
+    weather_data->h2_cond        = record.h2_cond;
+    weather_data->h2_time        = record.h2_time;
+    weather_data->h2_pop         = record.h2_pop;
+    weather_data->hourly_enabled = record.hourly_enabled;
+    weather_data->hourly_updated = record.hourly_updated;
+    weather_data->updated        = record.updated;
+    weather_data->next_fetch     = record.next_fetch;
+    
+    if (persist_exists(KEY_WEATHER_LOCALE)) {
+        persist_read_string(KEY_WEATHER_LOCALE, weather_data->locale, sizeof(weather_data->locale));
+        stored_locale_hash = locale_hash(weather_data->locale);
+    } else {
+        weather_data->locale[0] = '\0';
+    }
+    
+    LOG_DEBUG("PersistLoad: weather updated:%i next:%i",
+              (int)weather_data->updated, (int)weather_data->next_fetch);
+    return true;
 }
 
 /**
- * Store weather data values to allow the app to quickly restore
+ * Store weather data values to allow the app to quickly restore. The record and the
+ * locale are only written when they changed.
  *
  * \return true on success, false otherwise
  */
 bool store_weather_values( WeatherData * weather_data )
 {
-    // Store off the current time,
-    // current conditions,
-    // hourly forecast
-    return false;
+    PersistedWeather record;
+    weather_record_from(&record, weather_data);
+    
+    if (memcmp(&record, &stored_weather, sizeof(record)) != 0)
+    {
+        if (persist_write_data(KEY_WEATHER_RECORD, &record, sizeof(record)) != (int)sizeof(record))
+        {
+            LOG_DEBUG("PersistStore: weather record failed");
+            event_log(EVENT_PERSIST_FAILED, 0, 0);
+            return false;
+        }
+        stored_weather = record;
+    }
+    else
+    {
+        LOG_DEBUG("PersistStore: weather unchanged");
+    }
+    
+    uint32_t hash = locale_hash(weather_data->locale);
+    if (hash != stored_locale_hash)
+    {
+        if (persist_write_string(KEY_WEATHER_LOCALE, weather_data->locale) < 0)
+        {
+            LOG_DEBUG("PersistStore: weather locale failed");
+            event_log(EVENT_PERSIST_FAILED, 2, 0);
+            return false;
+        }
+        stored_locale_hash = hash;
+    }
+    return true;
 }
\ No newline at end of file
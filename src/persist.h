@@ -3,5 +3,7 @@
 
 void load_persisted_values(WeatherData *weather_data);
 void store_persisted_values(WeatherData *weather_data);
+bool load_weather_values(WeatherData *weather_data);
+bool store_weather_values(WeatherData *weather_data);
 
 #endif
\ No newline at end of file
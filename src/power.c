@@ -0,0 +1,110 @@
+#include <pebble.h>
+#include "power.h"
+#include "battery_layer.h"
+
+/* Charge below which a mode is entered, and at or above which it is left again */
+#define SAVER_ENTER_PERCENT    30
+#define SAVER_LEAVE_PERCENT    40
+#define CRITICAL_ENTER_PERCENT 10
+#define CRITICAL_LEAVE_PERCENT 20
+
+/* Least time between weather refreshes per mode */
+static const int MIN_REFRESH_INTERVAL[] = {
+  0,            // POWER_NORMAL, as the phone suggests
+  60 * 60,      // POWER_SAVER, 1 hour in seconds
+  3 * 60 * 60   // POWER_CRITICAL, 3 hours in seconds
+};
+
+static PowerMode mode = POWER_NORMAL;
+static PowerModeHandler mode_handler = NULL;
+
+/**
+ * Pick the mode for a charge level. The battery reports in steps of 10%, leaving
+ * a mode takes a higher charge than entering it so the mode does not flip back
+ * and forth on a level boundary.
+ */
+static PowerMode mode_for_charge( uint8_t percent )
+{
+    if ( percent < CRITICAL_ENTER_PERCENT ||
+         (mode == POWER_CRITICAL && percent < CRITICAL_LEAVE_PERCENT) )
+    {
+        return POWER_CRITICAL;
+    }
+    if ( percent < SAVER_ENTER_PERCENT ||
+         (mode != POWER_NORMAL && percent < SAVER_LEAVE_PERCENT) )
+    {
+        return POWER_SAVER;
+    }
+    return POWER_NORMAL;
+}
+
+/**
+ * Handle a battery state change, the power module owns the battery state service
+ * and passes the state on to the battery layer
+ */
+static void handle_battery_state( BatteryChargeState charge_state )
+{
+    PowerMode new_mode = mode_for_charge(charge_state.charge_percent);
+    bool changed = new_mode != mode;
+    mode = new_mode;
+    
+    battery_state_changed(charge_state);
+    
+    if ( changed && mode_handler )
+    {
+        mode_handler(mode);
+    }
+}
+
+/**
+ * Start following the battery, the handler is called whenever the mode changes,
+ * including right away when starting on a low battery
+ */
+void power_init( PowerModeHandler handler )
+{
+    mode = POWER_NORMAL;
+    mode_handler = handler;
+    handle_battery_state(battery_state_service_peek());
+    battery_state_service_subscribe(handle_battery_state);
+}
+
+/**
+ * Stop following the battery
+ */
+void power_deinit()
+{
+    battery_state_service_unsubscribe();
+    mode_handler = NULL;
+}
+
+/**
+ * The current power mode
+ */
+PowerMode power_mode()
+{
+    return mode;
+}
+
+/**
+ * Whether the loading and charging animations may run
+ */
+bool power_animations_enabled()
+{
+    return mode == POWER_NORMAL;
+}
+
+/**
+ * Whether the phone should fetch the hourly forecast
+ */
+bool power_hourly_enabled()
+{
+    return mode == POWER_NORMAL;
+}
+
+/**
+ * Least time in seconds between weather refreshes, 0 to follow the phone's schedule
+ */
+int power_min_refresh_interval()
+{
+    return MIN_REFRESH_INTERVAL[mode];
+}
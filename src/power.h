@@ -0,0 +1,20 @@
+#ifndef POWER_H
+#define POWER_H
+
+/* Power modes, from the battery charge with some hysteresis */
+typedef enum {
+  POWER_NORMAL = 0,
+  POWER_SAVER,    // longer refresh interval, no animations, no hourly forecast
+  POWER_CRITICAL  // like POWER_SAVER, refreshing even less often
+} PowerMode;
+
+typedef void (*PowerModeHandler)( PowerMode mode );
+
+void power_init( PowerModeHandler handler );
+void power_deinit();
+PowerMode power_mode();
+bool power_animations_enabled();
+bool power_hourly_enabled();
+int  power_min_refresh_interval();
+
+#endif
@@ -3,18 +3,21 @@
 #include "weather_layer.h"
 #include "debug_layer.h"
 #include "weather_icon_maps.h"
+#include "metrics.h"
+#include "power.h"
 
 static Layer *weather_layer;
 
 // Buffer the day / night time switch around sunrise & sunset
 const int CIVIL_TWILIGHT_BUFFER = 900; // 15 minutes
 const int WEATHER_ANIMATION_REFRESH = 1000; // 1 second animation 
+const int WEATHER_ANIMATION_IDLE_REFRESH = 10000; // 10s, checks for data without animating
 const int WEATHER_INITIAL_RETRY_TIMEOUT = 65; // Maybe our initial request failed? Try again!
 const int WEATHER_ANIMATION_TIMEOUT = 90; // 60 * WEATHER_ANIMATION_REFRESH = 60s
 const int WEATHER_STALE_TIMEOUT = 60 * 60 * 2; // 2 hours in seconds
 
-// Keep pointers to the two fonts we use.
-static GFont large_font, small_font;
+// Keep pointers to the two fonts we use, loaded once there is weather to show
+static GFont large_font = NULL, small_font = NULL;
 
 // Initial animation dots
 static AppTimer *weather_animation_timer;
@@ -48,6 +51,14 @@ static void weather_layer_set_icon(WeatherIcon icon, WeatherDisplayArea area)
   static BitmapLayer *layer = NULL;
   static GBitmap *icons = NULL;
 
+  // The icon sheets are loaded when first needed, not at startup
+  if (area == AREA_PRIMARY && wld->primary_icons == NULL) {
+    wld->primary_icons = gbitmap_create_with_resource(RESOURCE_ID_ICON_45X45);
+  }
+  if (area != AREA_PRIMARY && wld->hourly_icons == NULL) {
+    wld->hourly_icons = gbitmap_create_with_resource(RESOURCE_ID_ICON_30X30);
+  }
+
   switch (area) {
     case AREA_PRIMARY:
       size  = wld->primary_icon_size;
@@ -101,8 +112,16 @@ void weather_animate(void *context)
   WeatherData *weather_data = (WeatherData*) context;
   WeatherLayerData *wld = layer_get_data(weather_layer);
 
+  metrics_count(METRIC_WAKEUPS);
+
   if (weather_data->updated == 0 && weather_data->error == WEATHER_E_OK) {    
     
+    // The dots stand still while saving power, only waking up now and then
+    if (!power_animations_enabled()) {
+      weather_animation_timer = app_timer_register(WEATHER_ANIMATION_IDLE_REFRESH, weather_animate, weather_data);
+      return;
+    }
+
     animation_step = (animation_step % 3) + 1;
     layer_mark_dirty(wld->loading_layer);
     weather_animation_timer = app_timer_register(WEATHER_ANIMATION_REFRESH, weather_animate, weather_data);
@@ -129,9 +148,6 @@ void weather_layer_create(GRect frame, Window *window)
   weather_layer = layer_create_with_data(frame, sizeof(WeatherLayerData));
   WeatherLayerData *wld = layer_get_data(weather_layer);
 
-  large_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FUTURA_30));
-  small_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FUTURA_17));
-
   wld->primary_icon_size = 45;
   wld->hourly_icon_size = 30;
 
@@ -144,7 +160,6 @@ void weather_layer_create(GRect frame, Window *window)
   wld->primary_temp_layer = text_layer_create(GRect(2, 38, 70, 35));
   text_layer_set_background_color(wld->primary_temp_layer, GColorClear);
   text_layer_set_text_alignment(wld->primary_temp_layer, GTextAlignmentCenter);
-  text_layer_set_font(wld->primary_temp_layer, large_font);
   layer_add_child(weather_layer, text_layer_get_layer(wld->primary_temp_layer));
 
   
@@ -156,7 +171,6 @@ void weather_layer_create(GRect frame, Window *window)
   wld->h1_temp_layer = text_layer_create(GRect(67, 47, 38, 20));
   text_layer_set_text_color(wld->h1_temp_layer, GColorBlack);
   text_layer_set_text_alignment(wld->h1_temp_layer, GTextAlignmentCenter);
-  text_layer_set_font(wld->h1_temp_layer, small_font);
   layer_add_child(weather_layer, text_layer_get_layer(wld->h1_temp_layer));
   
   // Hour1 bitmap layer
@@ -172,7 +186,6 @@ void weather_layer_create(GRect frame, Window *window)
   wld->h2_temp_layer = text_layer_create(GRect(106, 47, 38, 20));
   text_layer_set_text_color(wld->h2_temp_layer, GColorBlack);
   text_layer_set_text_alignment(wld->h2_temp_layer, GTextAlignmentCenter);
-  text_layer_set_font(wld->h2_temp_layer, small_font);
   layer_add_child(weather_layer, text_layer_get_layer(wld->h2_temp_layer));
    
   // Hour2 bitmap layer
@@ -187,8 +200,8 @@ void weather_layer_create(GRect frame, Window *window)
   layer_set_update_proc(wld->loading_layer, weather_animate_update);
   layer_add_child(weather_layer, wld->loading_layer);
 
-  wld->primary_icons = gbitmap_create_with_resource(RESOURCE_ID_ICON_45X45);
-  wld->hourly_icons  = gbitmap_create_with_resource(RESOURCE_ID_ICON_30X30);
+  wld->primary_icons = NULL;
+  wld->hourly_icons  = NULL;
 
   wld->primary_icon = NULL;
   wld->h1_icon = NULL;
@@ -205,12 +218,30 @@ void weather_layer_clear_temperature()
   text_layer_set_text(wld->primary_temp_layer, "");
 }
 
-void weather_layer_set_temperature(int16_t t, bool is_stale)
+/*
+ * Convert a temperature in tenths of a degree Celsius into whole degrees of the
+ * given scale, rounding half away from zero
+ */
+static int temperature_for_scale(int16_t t, const char *scale)
+{
+  int tenths = t;
+  if (strcmp(scale, SCALE_FAHRENHEIT) == 0) {
+    tenths = tenths * 9 / 5 + 320;
+  }
+  return tenths >= 0 ? (tenths + 5) / 10 : (tenths - 5) / 10;
+}
+
+void weather_layer_set_temperature(int16_t t, const char *scale, bool is_stale)
 {
   WeatherLayerData *wld = layer_get_data(weather_layer);
 
+  if (large_font == NULL) {
+    large_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FUTURA_30));
+    text_layer_set_font(wld->primary_temp_layer, large_font);
+  }
+
   snprintf(wld->primary_temp_str, sizeof(wld->primary_temp_str), 
-    "%i%s", t, is_stale ? " " : "°");
+    "%i%s", temperature_for_scale(t, scale), is_stale ? " " : "°");
 
   text_layer_set_text(wld->primary_temp_layer, wld->primary_temp_str);
 }
@@ -229,6 +260,8 @@ void weather_layer_update(WeatherData *weather_data)
     return;
   }
 
+  metrics_count(METRIC_REDRAWS);
+
   WeatherLayerData *wld = layer_get_data(weather_layer);
 
   if (weather_animation_timer && animation_timer_enabled) {
@@ -270,7 +303,7 @@ void weather_layer_update(WeatherData *weather_data)
     layer_set_frame(bitmap_layer_get_layer(wld->primary_icon_layer), PRIMARY_ICON_NORMAL_FRAME);
 
     // Show the temperature as 'stale' if it has not been updated in WEATHER_STALE_TIMEOUT
-    weather_layer_set_temperature(weather_data->temperature, stale);
+    weather_layer_set_temperature(weather_data->temperature, weather_data->scale, stale);
 
     // Day/night check
     time_t utc = current_time + weather_data->tzoffset;
@@ -282,14 +315,24 @@ void weather_layer_update(WeatherData *weather_data)
        (int)current_time, (int)utc, weather_data->sunrise, weather_data->sunset, night_time);
     */
 
-    if (strcmp(weather_data->service, SERVICE_OPEN_WEATHER) == 0) {
+    // Condition codes depend on the provider which answered, not the one configured
+    const char *provider = weather_data->provider[0] ? weather_data->provider : weather_data->service;
+    if (strcmp(provider, SERVICE_OPEN_WEATHER) == 0) {
       weather_layer_set_icon(open_weather_icon_for_condition(weather_data->condition, night_time), AREA_PRIMARY);
+    } else if (strcmp(provider, SERVICE_WUNDER_WEATHER) == 0) {
+      weather_layer_set_icon(wunder_conditions_icon(weather_data->condition, night_time), AREA_PRIMARY);
     } else {
       weather_layer_set_icon(yahoo_weather_icon_for_condition(weather_data->condition, night_time), AREA_PRIMARY);
     }
 
     if (weather_data->hourly_updated != 0 && weather_data->hourly_enabled) {
 
+      if (small_font == NULL) {
+        small_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FUTURA_17));
+        text_layer_set_font(wld->h1_temp_layer, small_font);
+        text_layer_set_font(wld->h2_temp_layer, small_font);
+      }
+
       time_t h1t = weather_data->h1_time - weather_data->tzoffset;
       time_t h2t = weather_data->h2_time - weather_data->tzoffset;
       strftime(time_h1, sizeof(time_h1), "%I%p", localtime(&h1t));
@@ -314,9 +357,9 @@ void weather_layer_update(WeatherData *weather_data)
       weather_layer_set_icon(wunder_forecast_icon_for_conditions(weather_data->h2_cond, night_time), AREA_HOURLY2);
 
       snprintf(wld->h1_temp_str, sizeof(wld->h1_temp_str), 
-        "%i%s", weather_data->h1_temp, "°");
+        "%i%s", temperature_for_scale(weather_data->h1_temp, weather_data->scale), "°");
       snprintf(wld->h2_temp_str, sizeof(wld->h2_temp_str), 
-        "%i%s", weather_data->h2_temp, "°");
+        "%i%s", temperature_for_scale(weather_data->h2_temp, weather_data->scale), "°");
 
       text_layer_set_text(wld->h1_temp_layer, wld->h1_temp_str);
       text_layer_set_text(wld->h2_temp_layer, wld->h2_temp_str);
@@ -362,8 +405,14 @@ void weather_layer_destroy()
   }
   layer_destroy(weather_layer);
 
-  fonts_unload_custom_font(large_font);
-  fonts_unload_custom_font(small_font);
+  if (large_font != NULL) {
+    fonts_unload_custom_font(large_font);
+    large_font = NULL;
+  }
+  if (small_font != NULL) {
+    fonts_unload_custom_font(small_font);
+    small_font = NULL;
+  }
 }
 
 /*
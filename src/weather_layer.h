@@ -74,7 +74,7 @@ void weather_layer_create(GRect frame, Window *window);
 void weather_animate(void *context);
 void weather_layer_update(WeatherData *weather_data);
 void weather_layer_destroy();
-void weather_layer_set_temperature(int16_t t, bool is_stale);
+void weather_layer_set_temperature(int16_t t, const char *scale, bool is_stale);
 void weather_layer_clear_temperature();
 uint8_t open_weather_icon_for_condition(int condition, bool night_time);
 uint8_t yahoo_weather_icon_for_condition(int condition, bool night_time);
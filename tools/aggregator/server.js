@@ -0,0 +1,270 @@
+/**
+ * Reference aggregator for the Weather-My-Way "aggregator" provider. Many devices in
+ * the same location cell share one upstream request for the cell centre: responses
+ * are normalized into the JSON record the phone builds the watch update from, cached
+ * per cell and served to every client, so upstream calls grow with the number of
+ * cells instead of the number of devices.
+ *
+ * Usage:
+ *   node server.js --fixtures fixtures          serve recorded responses, no network
+ *   node server.js --appid <OpenWeatherMap key> fetch from OpenWeatherMap
+ *
+ * Options: --port <port> (default 8080), --ttl <seconds> (default 600)
+ *
+ * Endpoints:
+ *   GET /weather?cell=<cell>                      normalized record for the cell
+ *   GET /stats                                    client requests vs upstream calls
+ *
+ * Point the watchface at it with the g=http://<host>:<port>/weather setting.
+ * @file tools/aggregator/server.js
+ */
+
+var http = require('http');
+var fs   = require('fs');
+var path = require('path');
+var url  = require('url');
+
+var SERVICE_OPEN_WEATHER = "open";
+
+/* Degrees per cell, must match Global.cellSize in pebble-js-app.js */
+var CELL_SIZE = 0.02;
+
+/**
+ * Command line configuration
+ */
+var Config = {
+    port:     8080,
+    ttl:      600, // seconds a cell's record is served from the cache
+    fixtures: null, // directory of recorded upstream responses
+    appid:    null // OpenWeatherMap api key
+};
+
+/**
+ * Cached records and in flight upstream requests by cell
+ */
+var Cache = {
+    cells:   {}, // cell -> { record, fetched }
+    pending: {}, // cell -> [callbacks]
+    stats:   { requests: 0, hits: 0, upstream: 0, errors: 0 }
+};
+
+/**
+ * Parse the command line into Config
+ *
+ * @param argv process.argv
+ */
+var parseArgs = function(argv)
+{
+    for (var i = 2; i < argv.length; i += 2) {
+        var name = argv[i].replace(/^--/, '');
+        if (!Config.hasOwnProperty(name) || i + 1 >= argv.length) {
+            throw new Error("Unknown option: " + argv[i]);
+        }
+        Config[name] = (name === 'port' || name === 'ttl') ? parseInt(argv[i + 1], 10) : argv[i + 1];
+    }
+    if (Config.fixtures === null && Config.appid === null) {
+        throw new Error("Either --fixtures or --appid is required");
+    }
+};
+
+/**
+ * Convert a temperature into tenths of a degree Celsius, see toTenthsCelsius in
+ * pebble-js-app.js
+ *
+ * @param kelvin Temperature in Kelvin
+ */
+var toTenthsCelsius = function(kelvin)
+{
+    return Math.round((parseFloat(kelvin) - 273.15) * 10);
+};
+
+/**
+ * Normalize an OpenWeatherMap response into the record served to the phones. The
+ * publish time and time zone offset depend on the phone and are filled in there.
+ *
+ * @param response OpenWeatherMap current weather response
+ */
+var normalize = function(response)
+{
+    return {
+        temperature: toTenthsCelsius(response.main.temp),
+        condition:   response.weather[0].id,
+        sunrise:     response.sys.sunrise,
+        sunset:      response.sys.sunset,
+        locale:      response.name,
+        provider:    SERVICE_OPEN_WEATHER,
+        observed:    response.dt * 1000
+    };
+};
+
+/**
+ * Load the upstream response of a cell from the fixtures directory, falling back
+ * on default.json
+ *
+ * @param cell     The location cell
+ * @param callback Called with (err, response)
+ */
+var fetchFixture = function(cell, callback)
+{
+    var file = path.join(Config.fixtures, cell.replace(/[^0-9,-]/g, '') + '.json');
+    if (!fs.existsSync(file)) {
+        file = path.join(Config.fixtures, 'default.json');
+    }
+    fs.readFile(file, 'utf8', function(err, data) {
+        if (err) {
+            callback(err.message);
+            return;
+        }
+        try {
+            callback(null, JSON.parse(data));
+        } catch (ex) {
+            callback(ex.message);
+        }
+    });
+};
+
+/**
+ * Request the current weather of a position from OpenWeatherMap
+ *
+ * @param lat      Latitude
+ * @param lon      Longitude
+ * @param callback Called with (err, response)
+ */
+var fetchOpenWeather = function(lat, lon, callback)
+{
+    var target = "http://api.openweathermap.org/data/2.5/weather?lat=" + lat +
+        "&lon=" + lon + "&appid=" + encodeURIComponent(Config.appid);
+    http.get(target, function(res) {
+        var body = '';
+        res.setEncoding('utf8');
+        res.on('data', function(chunk) { body += chunk; });
+        res.on('end', function() {
+            if (res.statusCode !== 200) {
+                callback("Upstream status: " + res.statusCode);
+                return;
+            }
+            try {
+                callback(null, JSON.parse(body));
+            } catch (ex) {
+                callback(ex.message);
+            }
+        });
+    }).on('error', function(err) {
+        callback(err.message);
+    });
+};
+
+/**
+ * Centre of a cell as built by locationCell in pebble-js-app.js
+ *
+ * @param cell The location cell, "<lat index>,<lon index>"
+ * @return { lat, lon }, or null if the cell is malformed
+ */
+var cellCentre = function(cell)
+{
+    var match = /^(-?\d+),(-?\d+)$/.exec(cell);
+    if (match === null) {
+        return null;
+    }
+    return {
+        lat: (parseInt(match[1], 10) * CELL_SIZE).toFixed(4),
+        lon: (parseInt(match[2], 10) * CELL_SIZE).toFixed(4)
+    };
+};
+
+/**
+ * Get the record of a cell, from the cache while it is fresh. Concurrent requests
+ * for a cell which is not cached share a single upstream request, made for the cell
+ * centre so the record does not depend on which device asked first.
+ *
+ * @param cell     The location cell
+ * @param callback Called with (err, record)
+ */
+var lookupCell = function(cell, callback)
+{
+    var cached = Cache.cells[cell];
+    if (cached && Date.now() - cached.fetched < Config.ttl * 1000) {
+        Cache.stats.hits++;
+        callback(null, cached.record);
+        return;
+    }
+    if (Cache.pending.hasOwnProperty(cell)) {
+        Cache.pending[cell].push(callback);
+        return;
+    }
+    Cache.pending[cell] = [callback];
+    Cache.stats.upstream++;
+    
+    var done = function(err, response) {
+        var record = null;
+        if (!err) {
+            try {
+                record = normalize(response);
+                Cache.cells[cell] = { record: record, fetched: Date.now() };
+            } catch (ex) {
+                err = "Unable to normalize upstream response: " + ex.message;
+            }
+        }
+        if (err) {
+            Cache.stats.errors++;
+            console.warn("Cell " + cell + ": " + err);
+        }
+        var callbacks = Cache.pending[cell];
+        delete Cache.pending[cell];
+        callbacks.forEach(function(cb) { cb(err, record); });
+    };
+    
+    if (Config.fixtures !== null) {
+        fetchFixture(cell, done);
+    } else {
+        var centre = cellCentre(cell);
+        fetchOpenWeather(centre.lat, centre.lon, done);
+    }
+};
+
+/**
+ * Write a JSON response
+ *
+ * @param res    The server response
+ * @param status HTTP status code
+ * @param body   Object to serialize
+ */
+var reply = function(res, status, body)
+{
+    res.writeHead(status, { 'Content-Type': 'application/json' });
+    res.end(JSON.stringify(body));
+};
+
+/**
+ * Handle a client request
+ */
+var onRequest = function(req, res)
+{
+    var request = url.parse(req.url, true);
+    if (request.pathname === '/stats') {
+        reply(res, 200, Cache.stats);
+        return;
+    }
+    if (request.pathname !== '/weather' || !request.query.cell) {
+        reply(res, 404, { error: "Not found" });
+        return;
+    }
+    if (cellCentre(request.query.cell) === null) {
+        reply(res, 400, { error: "Malformed cell" });
+        return;
+    }
+    Cache.stats.requests++;
+    lookupCell(request.query.cell, function(err, record) {
+        if (err) {
+            reply(res, 502, { error: "Upstream unavailable" });
+        } else {
+            reply(res, 200, record);
+        }
+    });
+};
+
+parseArgs(process.argv);
+http.createServer(onRequest).listen(Config.port, function() {
+    console.log("Aggregator listening on port " + Config.port +
+                (Config.fixtures !== null ? " serving fixtures from " + Config.fixtures : ""));
+});
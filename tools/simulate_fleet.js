@@ -0,0 +1,151 @@
+/**
+ * Fleet simulation for the per-device fetch offset. Loads the PebbleKit JS with stubbed
+ * Pebble and localStorage objects and compares the peak to average requests per minute
+ * of many simulated devices over an hour, with and without the offset.
+ *
+ * Usage:
+ *   node tools/simulate_fleet.js [devices] [stations]   (default 10000 and 20)
+ *
+ * Schedules compared, a request is sent on the first minute tick at or after its time:
+ *   fixed    every device at 18 and 48 mins past the hour, as before the offset, or
+ *            moved by the device's offset in whole minutes as used until the phone
+ *            suggests a time
+ *   publish  the time the app's own nextPublishFetch() suggests from a learned cadence.
+ *            Each device watches one of the stations, which publish at their own minute
+ *            every 30 or 60 minutes, and has learned a margin of 1 to 5 minutes.
+ *
+ * The stations and margins come from a seeded generator, runs are repeatable.
+ * @file tools/simulate_fleet.js
+ */
+
+var vm   = require('vm');
+var fs   = require('fs');
+var path = require('path');
+
+var HOUR_MINUTES = 60;
+var SEED         = 20141019;
+
+/**
+ * Load the app into a sandbox with just enough of the phone to compute offsets, the
+ * account token it reports is set in Pebble.account
+ */
+var loadApp = function()
+{
+    var store = {};
+    var sandbox = {
+        console: { log: function() {}, warn: function() {} },
+        setTimeout: setTimeout, clearTimeout: clearTimeout,
+        localStorage: {
+            getItem:    function(k) { return store.hasOwnProperty(k) ? store[k] : null; },
+            setItem:    function(k, v) { store[k] = String(v); },
+            removeItem: function(k) { delete store[k]; }
+        },
+        navigator: { geolocation: {} },
+        XMLHttpRequest: function() {},
+        Pebble: {
+            account: '',
+            addEventListener: function() {},
+            sendAppMessage: function() {},
+            getAccountToken: function() { return sandbox.Pebble.account; }
+        }
+    };
+    vm.createContext(sandbox);
+    vm.runInContext(fs.readFileSync(path.join(__dirname, '../src/js/pebble-js-app.js'), 'utf8'), sandbox);
+    return sandbox;
+};
+
+/**
+ * Repeatable pseudo random numbers in [0, 1)
+ *
+ * @param seed Start of the sequence
+ */
+var generator = function(seed)
+{
+    var state = seed >>> 0;
+    return function() {
+        state = (Math.imul(state, 1664525) + 1013904223) >>> 0;
+        return state / 4294967296;
+    };
+};
+
+/**
+ * Peak to average of the requests per minute over an hour
+ *
+ * @param minutes Minute of the hour each device sends its request on
+ */
+var peakToAverage = function(minutes)
+{
+    var buckets = [];
+    for (var i = 0; i < HOUR_MINUTES; i++) {
+        buckets.push(0);
+    }
+    minutes.forEach(function(minute) {
+        buckets[((minute % HOUR_MINUTES) + HOUR_MINUTES) % HOUR_MINUTES]++;
+    });
+    return Math.max.apply(null, buckets) / (minutes.length / HOUR_MINUTES);
+};
+
+/**
+ * Minute of the hour a device sends the request the phone suggested for a cadence
+ *
+ * @param app     The sandboxed app
+ * @param cadence The device's learned cadence of its station
+ * @param now     Time of the suggestion in ms
+ */
+var suggestedMinute = function(app, cadence, now)
+{
+    app.cadence = cadence;
+    app.now     = now;
+    var next = vm.runInContext('nextPublishFetch(cadence, now)', app);
+    return Math.ceil(next / 60000) % HOUR_MINUTES;
+};
+
+var main = function()
+{
+    var devices  = parseInt(process.argv[2], 10) || 10000;
+    var stations = parseInt(process.argv[3], 10) || 20;
+    var random   = generator(SEED);
+    var app      = loadApp();
+    var offset   = vm.runInContext('fetchOffset', app);
+    var noOffset = function() { return 0; };
+    var schedules = { 'fixed': [[], []], 'publish': [[], []] }; // without, with offset
+
+    var hour = Math.floor(Date.UTC(2014, 9, 19, 12) / 3600000) * 3600000;
+    var published = [];
+    for (var s = 0; s < stations; s++) {
+        var period = (random() < 0.5 ? 30 : 60) * 60000;
+        published.push({ minute: Math.floor(random() * period / 60000), period: period });
+    }
+
+    for (var i = 0; i < devices; i++) {
+        app.Pebble.account = 'device-' + i;
+        var station = published[Math.floor(random() * stations)];
+        // the device last fetched somewhere in the period after the last publish
+        var last    = hour + station.minute * 60000;
+        var now     = last + Math.floor(random() * station.period);
+        var cadence = {
+            last:      last,
+            intervals: [station.period, station.period, station.period, station.period],
+            margin:    (1 + Math.floor(random() * 5)) * 60000,
+            suggested: 0
+        };
+        schedules['fixed'][0].push(18, 48);
+        // the watch is told the offset in whole minutes with js_ready
+        var shift = Math.floor(vm.runInContext('fetchOffset()', app) / 60000);
+        schedules['fixed'][1].push(18 + shift, 48 + shift);
+        app.fetchOffset = noOffset;
+        schedules['publish'][0].push(suggestedMinute(app, cadence, now));
+        app.fetchOffset = offset;
+        schedules['publish'][1].push(suggestedMinute(app, cadence, now));
+    }
+
+    console.log(devices + " devices on " + stations + " stations, requests per minute over an hour, " +
+                "peak / average without and with the offset:");
+    Object.keys(schedules).forEach(function(name) {
+        console.log("  " + (name + "        ").slice(0, 9) +
+                    peakToAverage(schedules[name][0]).toFixed(2) + "  " +
+                    peakToAverage(schedules[name][1]).toFixed(2));
+    });
+};
+
+main();
@@ -0,0 +1,96 @@
+/*
+ * Replays scripted Bluetooth drop and reconnect sequences against the handlers in
+ * main.c, with a stand-in Bluetooth service and fake timers
+ */
+#include "fake_clock.h"
+
+static int vibrations = 0;
+static int requests = 0;
+static bool connected = true;
+
+void vibes_double_pulse(void) { vibrations++; }
+bool bluetooth_connection_service_peek(void) { return connected; }
+
+#include "face_main.h"
+
+/* The rest of the face, only what the Bluetooth handlers touch is counted */
+static uint32_t metric_values[METRIC_COUNT];
+void metrics_count(Metric metric) { metric_values[metric]++; }
+bool request_weather(WeatherData *weather) { requests++; return true; }
+BatteryChargeState battery_state_service_peek(void) { return (BatteryChargeState){ 80, false, false }; }
+
+static void bt(bool state)
+{
+  connected = state;
+  handle_bt_event(state);
+}
+
+static void reset()
+{
+  advance(60000);
+  vibrations = requests = 0;
+  metric_values[METRIC_BT_FLAPS] = 0;
+}
+
+int main(void)
+{
+  fake_clock_reset();
+  WeatherData wd = { 0 };
+  weather_data = &wd;
+  wd.updated = time(NULL);
+  wd.next_fetch = time(NULL) + 3600;
+
+  printf("20 drops of 2s, 1s apart, fresh weather\n");
+  for (int i = 0; i < 20; i++) { bt(false); advance(2000); bt(true); advance(1000); }
+  advance(BT_RECONNECT_SETTLE);
+  CHECK_EQ("vibrations", vibrations, 0);
+  CHECK_EQ("flaps", metric_values[METRIC_BT_FLAPS], 20);
+  CHECK_EQ("requests", requests, 0);
+  reset();
+
+  printf("20 drops of 2s, 1s apart, stale weather\n");
+  wd.next_fetch = time(NULL) - 1;
+  for (int i = 0; i < 20; i++) { bt(false); advance(2000); bt(true); advance(1000); }
+  CHECK_EQ("requests before the link settled", requests, 0);
+  advance(BT_RECONNECT_SETTLE);
+  CHECK_EQ("vibrations", vibrations, 0);
+  CHECK_EQ("flaps", metric_values[METRIC_BT_FLAPS], 20);
+  CHECK_EQ("requests", requests, 1);
+  reset();
+
+  printf("drop just shorter than BT_DROP_GRACE\n");
+  bt(false); advance(BT_DROP_GRACE - 1000); bt(true); advance(BT_RECONNECT_SETTLE);
+  CHECK_EQ("vibrations", vibrations, 0);
+  CHECK_EQ("flaps", metric_values[METRIC_BT_FLAPS], 1);
+  CHECK_EQ("requests", requests, 1);
+  reset();
+
+  printf("60s outage\n");
+  bt(false); advance(60000);
+  CHECK_EQ("vibrations during the outage", vibrations, 1);
+  CHECK_EQ("error shown", wd.error, WEATHER_E_PHONE);
+  bt(true); advance(BT_RECONNECT_SETTLE - 1000);
+  CHECK_EQ("requests before BT_RECONNECT_SETTLE", requests, 0);
+  advance(1000);
+  CHECK_EQ("requests after BT_RECONNECT_SETTLE", requests, 1);
+  CHECK_EQ("flaps", metric_values[METRIC_BT_FLAPS], 0);
+  reset();
+
+  printf("outage with a flapping recovery\n");
+  bt(false); advance(20000);
+  for (int i = 0; i < 5; i++) { bt(true); advance(1000); bt(false); advance(1000); }
+  bt(true); advance(BT_RECONNECT_SETTLE);
+  CHECK_EQ("vibrations", vibrations, 1);
+  CHECK_EQ("flaps", metric_values[METRIC_BT_FLAPS], 0);
+  CHECK_EQ("requests", requests, 1);
+  reset();
+
+  printf("reconnect shorter than BT_RECONNECT_SETTLE after an outage, then a drop\n");
+  bt(false); advance(20000); bt(true); advance(BT_RECONNECT_SETTLE - 1000); bt(false);
+  advance(60000);
+  CHECK_EQ("vibrations", vibrations, 1);
+  CHECK_EQ("requests", requests, 0);
+  reset();
+
+  return check_failures;
+}
@@ -0,0 +1,80 @@
+/*
+ * Simulates a day of minute ticks per power mode against main.c, power.c and the
+ * battery layer, counting wakeups, refreshes and messages. The phone's reply lands a
+ * few seconds after the tick that sent the request, as it does on the watch.
+ */
+#include "fake_clock.h"
+
+#define REPLY_DELAY 3000 // 3s
+
+static int wakeups = 0;
+static int refreshes = 0;
+static int messages = 0;
+static BatteryChargeState battery = { 80, false, false };
+
+void vibes_double_pulse(void) {}
+bool bluetooth_connection_service_peek(void) { return true; }
+BatteryChargeState battery_state_service_peek(void) { return battery; }
+
+#include "face_main.h"
+#include "power.c"
+#include "battery_layer.c"
+
+static void reply_callback(void *data)
+{
+  ((WeatherData*)data)->updated = time(NULL);
+  messages++;
+}
+
+/* The rest of the face, a request is answered after REPLY_DELAY */
+bool request_weather(WeatherData *weather)
+{
+  refreshes++;
+  messages++;
+  app_timer_register(REPLY_DELAY, reply_callback, weather);
+  return true;
+}
+void metrics_count(Metric metric) { if (metric == METRIC_WAKEUPS) wakeups++; }
+
+static void day(const char *name, uint8_t percent, bool charging,
+                int expected_wakeups, int expected_refreshes)
+{
+  fake_clock_reset();
+  WeatherData wd = { 0 };
+  weather_data = &wd;
+  wd.updated = time(NULL) - 24 * 60 * 60;
+  initial_request = false;
+  battery = (BatteryChargeState){ percent, charging, charging };
+  battery_layer_create(GRect(0, 0, 1, 1), NULL);
+  battery_disable_display();
+  battery_enable_display();
+  power_init(handle_power_mode);
+
+  wakeups = refreshes = messages = 0;
+  for (int minute = 0; minute < 24 * 60; minute++) {
+    advance(60000);
+    time_t now = time(NULL);
+    wakeups++;
+    handle_tick(gmtime(&now), MINUTE_UNIT);
+  }
+  int day_wakeups = wakeups;
+  advance(REPLY_DELAY);
+
+  printf("%s: mode %d, %d messages\n", name, power_mode(), messages);
+  CHECK_EQ("wakeups", day_wakeups, expected_wakeups);
+  CHECK_EQ("refreshes", refreshes, expected_refreshes);
+  CHECK_EQ("messages", messages, 2 * refreshes);
+
+  battery_disable_display();
+  power_deinit();
+}
+
+int main(void)
+{
+  day("normal (80%)", 80, false, 1440, 48);
+  day("normal, charging", 80, true, 44640, 48);
+  day("saver (25%)", 25, false, 1440, 24);
+  day("saver, charging", 25, true, 1440, 24);
+  day("critical (5%)", 5, false, 1440, 8);
+  return check_failures;
+}
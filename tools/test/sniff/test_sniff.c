@@ -0,0 +1,131 @@
+/*
+ * Models a day of 48 weather refreshes against the request state machine in
+ * network.c, following the sniff interval it asks for. This is a model, not a
+ * measurement: the SDK does not publish the intervals, so they are assumed below, and
+ * each crossing of the link waits half an interval on average. The Makefile builds it
+ * twice, as sniff and as sniff_normal with EXCHANGE_SNIFF_REDUCED=0, the build of
+ * ./waf configure --exchange-sniff=normal.
+ */
+#include "fake_clock.h"
+
+#define NORMAL_INTERVAL   1280 // ms, assumed
+#define REDUCED_INTERVAL  30   // ms, assumed
+#define RADIO_PER_WAKEUP  1.25 // ms of radio time per sniff wakeup, assumed
+#define JS_READY_DELAY    800  // ms from launch to js_ready
+#define REFRESHES         48
+
+static SniffInterval sniff = SNIFF_INTERVAL_NORMAL;
+static uint32_t reduced_since = 0;
+static uint32_t reduced_total = 0;
+static int sniff_calls = 0;
+
+void app_comm_set_sniff_interval(const SniffInterval interval)
+{
+  sniff_calls++;
+  if (interval == SNIFF_INTERVAL_REDUCED) {
+    reduced_since = clock_ms;
+  } else {
+    reduced_total += clock_ms - reduced_since;
+  }
+  sniff = interval;
+}
+
+bool bluetooth_connection_service_peek(void) { return true; }
+
+#include "network.c"
+#include "fake_appmsg.h"
+
+/* The rest of the face, only the metrics are kept */
+static uint32_t metric_values[METRIC_COUNT];
+static WeatherData wd;
+void metrics_count(Metric metric) { metric_values[metric]++; }
+void metrics_add(Metric metric, uint32_t amount) { metric_values[metric] += amount; }
+uint32_t latency_now_ms() { return clock_ms; }
+void initial_jsready_callback() { request_weather(&wd); }
+
+/* Each crossing of the link waits for the next sniff wakeup */
+static uint32_t crossing()
+{
+  return (sniff == SNIFF_INTERVAL_REDUCED ? REDUCED_INTERVAL : NORMAL_INTERVAL) / 2;
+}
+
+/* One day of refreshes, returns the average refresh latency and the time reduced */
+static void day(uint32_t phone_ms, uint32_t *latency, uint32_t *reduced)
+{
+  fake_clock_reset();
+  memset(metric_values, 0, sizeof(metric_values));
+  reduced_total = 0;
+  sniff_calls = 0;
+  strcpy(wd.service, SERVICE_YAHOO_WEATHER);
+  strcpy(wd.scale, SCALE_FAHRENHEIT);
+
+  uint32_t started = clock_ms;
+  init_network(&wd);
+  CHECK_EQ("interval while waiting for js_ready", sniff, EXCHANGE_SNIFF_REDUCED);
+  advance(JS_READY_DELAY);
+  receive_int(KEY_JS_READY, 1);
+
+  uint32_t latency_total = 0;
+  int in_flight = 0, back_to_normal = 0;
+  for (int i = 0; i < REFRESHES; i++) {
+    if (i > 0) {
+      request_weather(&wd);
+    }
+    in_flight += sniff == SNIFF_INTERVAL_REDUCED;
+    // the request out and the answer back both cross while the request is in flight
+    uint32_t refresh = crossing() + phone_ms + crossing();
+    advance(refresh);
+    receive_weather(i + 1, req_id);
+    back_to_normal += sniff == SNIFF_INTERVAL_NORMAL;
+    latency_total += refresh;
+    advance(30 * 60 * 1000 - refresh);
+  }
+  close_network();
+
+  uint32_t elapsed = clock_ms - started;
+  CHECK_EQ("requests sent with the reduced interval", in_flight,
+           EXCHANGE_SNIFF_REDUCED ? REFRESHES : 0);
+  CHECK_EQ("back to the normal interval after each answer", back_to_normal, REFRESHES);
+  CHECK_EQ("interval changes, in and out for js_ready and each request", sniff_calls,
+           EXCHANGE_SNIFF_REDUCED ? 2 * (REFRESHES + 1) : 0);
+  CHECK_EQ("sniff_reduced_ms metric matches the reduced time",
+           metric_values[METRIC_SNIFF_REDUCED_MS], reduced_total);
+  *latency = latency_total / REFRESHES;
+  *reduced = reduced_total * (86400000.0 / elapsed);
+}
+
+/* Radio time of a day of sniff wakeups, reduced for the given time */
+static double radio_seconds(uint32_t reduced)
+{
+  return ((86400000.0 - reduced) / NORMAL_INTERVAL + (double)reduced / REDUCED_INTERVAL) *
+         RADIO_PER_WAKEUP / 1000;
+}
+
+int main(void)
+{
+  static const uint32_t phone_times[] = { 1500, 4000 };
+  const char *name = EXCHANGE_SNIFF_REDUCED ? "reduced" : "normal";
+  char rows[2][96];
+
+  for (int p = 0; p < 2; p++) {
+    uint32_t latency, reduced;
+    printf("phone %ums, %s sniff\n", (unsigned)phone_times[p], name);
+    day(phone_times[p], &latency, &reduced);
+    CHECK_EQ("refresh latency, the phone and two crossings", latency,
+             phone_times[p] + (EXCHANGE_SNIFF_REDUCED ? REDUCED_INTERVAL : NORMAL_INTERVAL));
+    char phone[16], refresh[16], reduced_day[16], radio[16];
+    snprintf(phone, sizeof(phone), "%gs", phone_times[p] / 1000.0);
+    snprintf(refresh, sizeof(refresh), "%.2fs", latency / 1000.0);
+    snprintf(reduced_day, sizeof(reduced_day), "%.0fs", reduced / 1000.0);
+    snprintf(radio, sizeof(radio), "%.1fs", radio_seconds(reduced));
+    snprintf(rows[p], sizeof(rows[0]), "| %-20s | %-7s | %-15s | %-18s | %-14s |",
+             phone, name, refresh, reduced_day, radio);
+  }
+
+  printf("\n| Phone time per fetch | Sniff   | Refresh latency | Time reduced / day | Radio on / day |\n");
+  printf("|----------------------|---------|-----------------|--------------------|----------------|\n");
+  for (int i = 0; i < 2; i++) {
+    printf("%s\n", rows[i]);
+  }
+  return check_failures;
+}
@@ -0,0 +1,105 @@
+/*
+ * No-op stand-ins for the rest of the face and the SDK calls the host tests do not
+ * follow. They are weak: a test replaces one by defining it or by compiling the real
+ * module, and they include the real headers so their signatures are checked.
+ */
+#include "pebble.h"
+#include "network.h"
+#include "main.h"
+#include "persist.h"
+#include "power.h"
+#include "latency.h"
+#include "metrics.h"
+#include "event_log.h"
+#include "weather_layer.h"
+#include "debug_layer.h"
+#include "battery_layer.h"
+#include "datetime_layer.h"
+
+#define STUB __attribute__((weak))
+
+/* SDK */
+STUB void app_log(uint8_t level, const char *file, int line, const char *fmt, ...) {}
+STUB void app_event_loop(void) {}
+STUB size_t heap_bytes_used(void) { return 0; }
+STUB Window *window_create(void) { return NULL; }
+STUB void window_destroy(Window *window) {}
+STUB void window_stack_push(Window *window, bool animated) {}
+STUB void window_set_background_color(Window *window, GColor color) {}
+STUB Layer *window_get_root_layer(const Window *window) { return NULL; }
+STUB Layer *layer_create(GRect frame) { static char layer; return (Layer*)&layer; }
+STUB void layer_destroy(Layer *layer) {}
+STUB void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {}
+STUB void layer_mark_dirty(Layer *layer) {}
+STUB void layer_add_child(Layer *parent, Layer *child) {}
+STUB void layer_set_hidden(Layer *layer, bool hidden) {}
+STUB void graphics_context_set_fill_color(GContext *ctx, GColor color) {}
+STUB void graphics_context_set_stroke_color(GContext *ctx, GColor color) {}
+STUB void graphics_fill_circle(GContext *ctx, GPoint p, uint16_t radius) {}
+STUB void graphics_draw_circle(GContext *ctx, GPoint p, uint16_t radius) {}
+STUB void tick_timer_service_subscribe(TimeUnits units, TickHandler handler) {}
+STUB void tick_timer_service_unsubscribe(void) {}
+STUB void battery_state_service_subscribe(BatteryStateHandler handler) {}
+STUB void battery_state_service_unsubscribe(void) {}
+STUB void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {}
+STUB void bluetooth_connection_service_unsubscribe(void) {}
+
+/* network.c */
+STUB void init_network(WeatherData *weather_data) {}
+STUB void close_network() {}
+
+/* persist.c */
+STUB void load_persisted_values(WeatherData *weather_data) {}
+STUB void store_persisted_values(WeatherData *weather_data) {}
+STUB bool load_weather_values(WeatherData *weather_data) { return false; }
+STUB bool store_weather_values(WeatherData *weather_data) { return true; }
+
+/* power.c */
+STUB void power_init(PowerModeHandler handler) {}
+STUB void power_deinit() {}
+STUB bool power_hourly_enabled() { return true; }
+STUB int power_min_refresh_interval() { return 0; }
+
+/* latency.c */
+STUB uint32_t latency_now_ms() { return 0; }
+STUB void latency_request_sent(uint16_t req_id) {}
+STUB void latency_response_received(uint16_t req_id, const uint8_t *stages, uint16_t length) {}
+
+/* metrics.c */
+STUB void metrics_init() {}
+STUB void metrics_deinit() {}
+STUB void metrics_outbox_failed(AppMessageResult reason) {}
+STUB void metrics_sample_heap() {}
+STUB void metrics_minute_tick() {}
+STUB void metrics_write(DictionaryIterator *iter) {}
+
+/* event_log.c */
+STUB void event_log_init() {}
+STUB void event_log_deinit() {}
+STUB void event_log(EventId id, uint8_t a, int16_t b) {}
+STUB void event_log_minute_tick() {}
+STUB void event_log_write(DictionaryIterator *iter) {}
+
+/* The layers */
+STUB void weather_layer_create(GRect frame, Window *window) {}
+STUB void weather_animate(void *context) {}
+STUB void weather_layer_update(WeatherData *weather_data) {}
+STUB void weather_layer_destroy() {}
+STUB void debug_layer_create(GRect frame, Window *window) {}
+STUB void debug_enable_display() {}
+STUB void debug_disable_display() {}
+STUB void debug_update_message(char *message) {}
+STUB void debug_update_weather(WeatherData *weather_data) {}
+STUB void debug_next_page() {}
+STUB void debug_layer_destroy() {}
+STUB void battery_layer_create(GRect frame, Window *window) {}
+STUB void battery_enable_display() {}
+STUB void battery_disable_display() {}
+STUB void battery_state_changed(BatteryChargeState charge_state) {}
+STUB void battery_layer_destroy() {}
+STUB void date_layer_create(GRect frame, Window *window) {}
+STUB void time_layer_create(GRect frame, Window *window) {}
+STUB void date_layer_update(struct tm *tick_time) {}
+STUB void time_layer_update() {}
+STUB void date_layer_destroy() {}
+STUB void time_layer_destroy() {}
@@ -0,0 +1,7 @@
+/*
+ * main.c for the host tests, its main() is renamed so the test brings its own
+ */
+#pragma once
+#define main watch_main
+#include "main.c"
+#undef main
@@ -0,0 +1,148 @@
+/*
+ * Fake dictionaries and AppMessage outbox for host tests. Dictionaries keep their
+ * tuples in a list, the outbox records what was sent and the tests deliver inbox
+ * messages with receive_*(). Include it after network.c, the helpers use its keys.
+ */
+#pragma once
+#include "pebble.h"
+
+#define FAKE_TUPLES 24
+
+struct DictionaryIterator {
+  int count;
+  int pos;
+  Tuple *tuples[FAKE_TUPLES];
+};
+
+static Tuple *fake_tuple(DictionaryIterator *iter, uint32_t key, uint16_t length)
+{
+  Tuple *tuple = calloc(1, sizeof(Tuple) + 260);
+  tuple->key = key;
+  tuple->length = length;
+  iter->tuples[iter->count++] = tuple;
+  return tuple;
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter)
+{
+  iter->pos = 0;
+  return iter->count ? iter->tuples[0] : NULL;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter)
+{
+  return ++iter->pos < iter->count ? iter->tuples[iter->pos] : NULL;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key)
+{
+  for (int i = 0; i < iter->count; i++) {
+    if (iter->tuples[i]->key == key) {
+      return iter->tuples[i];
+    }
+  }
+  return NULL;
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *value)
+{
+  strcpy(fake_tuple(iter, key, strlen(value) + 1)->value->cstring, value);
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value)
+{
+  fake_tuple(iter, key, 1)->value->uint32 = value;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value)
+{
+  fake_tuple(iter, key, 2)->value->uint32 = value;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value)
+{
+  fake_tuple(iter, key, 4)->value->int32 = value;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *data, const uint16_t length)
+{
+  memcpy(fake_tuple(iter, key, length)->value->data, data, length);
+  return DICT_OK;
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) { return 0; }
+uint32_t dict_size(DictionaryIterator *iter) { return 0; }
+
+/* The outbox takes one message at a time, outbox_sends counts what it took */
+static DictionaryIterator outbox;
+static int outbox_sends = 0;
+static AppMessageResult outbox_result = APP_MSG_OK;
+
+static AppMessageInboxReceived inbox_received = NULL;
+static AppMessageOutboxSent outbox_sent = NULL;
+static AppMessageOutboxFailed outbox_failed = NULL;
+static void *appmsg_context = NULL;
+
+AppMessageResult app_message_open(const uint32_t inbox, const uint32_t out) { return APP_MSG_OK; }
+void app_message_deregister_callbacks(void) {}
+void *app_message_set_context(void *context) { appmsg_context = context; return context; }
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived callback)
+{
+  return inbox_received = callback;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped callback)
+{
+  return callback;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent callback)
+{
+  return outbox_sent = callback;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed callback)
+{
+  return outbox_failed = callback;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iter)
+{
+  if (outbox_result != APP_MSG_OK) {
+    *iter = NULL;
+    return outbox_result;
+  }
+  outbox.count = 0;
+  *iter = &outbox;
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void)
+{
+  outbox_sends++;
+  return APP_MSG_OK;
+}
+
+/* Deliver a message with one integer from the phone */
+static void receive_int(uint32_t key, int32_t value)
+{
+  DictionaryIterator in = { 0 };
+  dict_write_int32(&in, key, value);
+  inbox_received(&in, appmsg_context);
+}
+
+/* Deliver a weather update with a new temperature, answering request req */
+static void receive_weather(int32_t seq, uint16_t req)
+{
+  DictionaryIterator in = { 0 };
+  dict_write_int32(&in, KEY_SEQ, seq);
+  dict_write_int32(&in, KEY_CHANGED, WEATHER_F_TEMPERATURE);
+  dict_write_int32(&in, KEY_TEMPERATURE, 100 + seq);
+  dict_write_uint16(&in, KEY_REQ_ID, req);
+  inbox_received(&in, appmsg_context);
+}
@@ -0,0 +1,89 @@
+/*
+ * Fake watch clock and app timers for host tests. Time only moves in advance(),
+ * which fires the timers falling due in order.
+ */
+#pragma once
+#include "pebble.h"
+
+#define FAKE_EPOCH   1700000000
+#define FAKE_TIMERS  16
+
+static uint32_t clock_ms = 0;
+
+typedef struct {
+  bool active;
+  uint32_t due;
+  AppTimerCallback callback;
+  void *data;
+} FakeTimer;
+
+static FakeTimer fake_timers[FAKE_TIMERS];
+
+AppTimer *app_timer_register(uint32_t ms, AppTimerCallback callback, void *data)
+{
+  for (int i = 0; i < FAKE_TIMERS; i++) {
+    if (!fake_timers[i].active) {
+      fake_timers[i] = (FakeTimer){ true, clock_ms + ms, callback, data };
+      return (AppTimer*)&fake_timers[i];
+    }
+  }
+  fprintf(stderr, "fake_clock: out of timers\n");
+  exit(2);
+}
+
+void app_timer_cancel(AppTimer *timer)
+{
+  ((FakeTimer*)timer)->active = false;
+}
+
+time_t time(time_t *t)
+{
+  time_t now = FAKE_EPOCH + clock_ms / 1000;
+  if (t) {
+    *t = now;
+  }
+  return now;
+}
+
+uint16_t time_ms(time_t *seconds, uint16_t *millis)
+{
+  *seconds = FAKE_EPOCH + clock_ms / 1000;
+  *millis  = clock_ms % 1000;
+  return *millis;
+}
+
+static void fake_clock_reset()
+{
+  memset(fake_timers, 0, sizeof(fake_timers));
+}
+
+/* Move the clock forward, firing every timer that falls due on the way */
+static void advance(uint32_t ms)
+{
+  uint32_t end = clock_ms + ms;
+  for (;;) {
+    int next = -1;
+    for (int i = 0; i < FAKE_TIMERS; i++) {
+      if (fake_timers[i].active && fake_timers[i].due <= end &&
+          (next < 0 || fake_timers[i].due < fake_timers[next].due)) {
+        next = i;
+      }
+    }
+    if (next < 0) {
+      break;
+    }
+    clock_ms = fake_timers[next].due;
+    fake_timers[next].active = false;
+    fake_timers[next].callback(fake_timers[next].data);
+  }
+  clock_ms = end;
+}
+
+/* Checks count their failures, a test exits with the number of failed checks */
+static int check_failures = 0;
+
+#define CHECK_EQ(what, actual, expected) do { \
+    long a_ = (long)(actual), e_ = (long)(expected); \
+    printf("%s %-60s %ld (expected %ld)\n", a_ == e_ ? "ok  " : "FAIL", what, a_, e_); \
+    if (a_ != e_) check_failures++; \
+  } while (0)
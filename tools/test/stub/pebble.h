@@ -0,0 +1,98 @@
+/*
+ * Stand-in for the parts of the Pebble SDK 2 header the watchface uses, enough to
+ * compile its sources on the host for the tests under tools/test
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+typedef struct { int16_t x, y; } GPoint;
+typedef struct { int16_t w, h; } GSize;
+typedef struct { GPoint origin; GSize size; } GRect;
+#define GRect(x,y,w,h) ((GRect){{(x),(y)},{(w),(h)}})
+#define GPoint(x,y) ((GPoint){(x),(y)})
+typedef enum { GColorClear=-1, GColorBlack=0, GColorWhite=1 } GColor;
+typedef enum { GTextAlignmentLeft, GTextAlignmentCenter, GTextAlignmentRight } GTextAlignment;
+typedef struct Layer Layer; typedef struct TextLayer TextLayer; typedef struct BitmapLayer BitmapLayer;
+typedef struct GBitmap GBitmap; typedef struct GContext GContext; typedef struct Window Window;
+typedef void* GFont; typedef struct AppTimer AppTimer; typedef struct Tuple Tuple;
+typedef struct DictionaryIterator DictionaryIterator;
+typedef void (*LayerUpdateProc)(Layer*, GContext*);
+typedef void (*AppTimerCallback)(void*);
+typedef enum { SECOND_UNIT=1, MINUTE_UNIT=2, HOUR_UNIT=4, DAY_UNIT=8 } TimeUnits;
+typedef enum { APP_LOG_LEVEL_ERROR=1, APP_LOG_LEVEL_WARNING=50, APP_LOG_LEVEL_INFO=100, APP_LOG_LEVEL_DEBUG=200, APP_LOG_LEVEL_DEBUG_VERBOSE=255 } AppLogLevel;
+#define APP_LOG(level, fmt, ...) app_log(level, __FILE__, __LINE__, fmt, ## __VA_ARGS__)
+void app_log(uint8_t, const char*, int, const char*, ...);
+typedef enum { APP_MSG_OK=0, APP_MSG_SEND_TIMEOUT=2, APP_MSG_SEND_REJECTED=4, APP_MSG_NOT_CONNECTED=8, APP_MSG_APP_NOT_RUNNING=16, APP_MSG_INVALID_ARGS=32, APP_MSG_BUSY=64, APP_MSG_BUFFER_OVERFLOW=128, APP_MSG_ALREADY_RELEASED=512, APP_MSG_CALLBACK_ALREADY_REGISTERED=1024, APP_MSG_CALLBACK_NOT_REGISTERED=2048, APP_MSG_OUT_OF_MEMORY=4096, APP_MSG_CLOSED=8192, APP_MSG_INTERNAL_ERROR=16384 } AppMessageResult;
+typedef enum { TUPLE_BYTE_ARRAY=0, TUPLE_CSTRING=1, TUPLE_UINT=2, TUPLE_INT=3 } TupleType;
+struct Tuple { uint32_t key; TupleType type:8; uint16_t length; union { uint8_t data[0]; char cstring[0]; uint8_t uint8; uint16_t uint16; uint32_t uint32; int8_t int8; int16_t int16; int32_t int32; } value[]; };
+typedef enum { DICT_OK=0 } DictionaryResult;
+Tuple *dict_read_first(DictionaryIterator*); Tuple *dict_read_next(DictionaryIterator*); Tuple *dict_find(const DictionaryIterator*, const uint32_t);
+DictionaryResult dict_write_cstring(DictionaryIterator*, const uint32_t, const char*);
+DictionaryResult dict_write_uint8(DictionaryIterator*, const uint32_t, const uint8_t);
+DictionaryResult dict_write_uint16(DictionaryIterator*, const uint32_t, const uint16_t);
+DictionaryResult dict_write_uint32(DictionaryIterator*, const uint32_t, const uint32_t);
+DictionaryResult dict_write_int32(DictionaryIterator*, const uint32_t, const int32_t);
+DictionaryResult dict_write_int16(DictionaryIterator*, const uint32_t, const int16_t);
+DictionaryResult dict_write_data(DictionaryIterator*, const uint32_t, const uint8_t*, const uint16_t);
+DictionaryResult dict_write_int(DictionaryIterator*, const uint32_t, const void*, const uint8_t, const bool);
+uint32_t dict_write_end(DictionaryIterator*);
+typedef void (*AppMessageInboxReceived)(DictionaryIterator*, void*);
+typedef void (*AppMessageInboxDropped)(AppMessageResult, void*);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator*, void*);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator*, AppMessageResult, void*);
+AppMessageResult app_message_open(const uint32_t, const uint32_t);
+void app_message_deregister_callbacks(void);
+void *app_message_set_context(void*);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed);
+AppMessageResult app_message_outbox_begin(DictionaryIterator**);
+AppMessageResult app_message_outbox_send(void);
+uint32_t app_message_inbox_size_maximum(void); uint32_t app_message_outbox_size_maximum(void);
+typedef enum { SNIFF_INTERVAL_NORMAL=0, SNIFF_INTERVAL_REDUCED=1 } SniffInterval;
+void app_comm_set_sniff_interval(const SniffInterval); SniffInterval app_comm_get_sniff_interval(void);
+AppTimer *app_timer_register(uint32_t, AppTimerCallback, void*); bool app_timer_reschedule(AppTimer*, uint32_t); void app_timer_cancel(AppTimer*);
+typedef struct { uint8_t charge_percent; bool is_charging; bool is_plugged; } BatteryChargeState;
+typedef void (*BatteryStateHandler)(BatteryChargeState);
+BatteryChargeState battery_state_service_peek(void); void battery_state_service_subscribe(BatteryStateHandler); void battery_state_service_unsubscribe(void);
+typedef void (*BluetoothConnectionHandler)(bool);
+bool bluetooth_connection_service_peek(void); void bluetooth_connection_service_subscribe(BluetoothConnectionHandler); void bluetooth_connection_service_unsubscribe(void);
+typedef void (*TickHandler)(struct tm*, TimeUnits);
+void tick_timer_service_subscribe(TimeUnits, TickHandler); void tick_timer_service_unsubscribe(void);
+void vibes_double_pulse(void); void vibes_short_pulse(void);
+uint16_t time_ms(time_t*, uint16_t*);
+#define PERSIST_DATA_MAX_LENGTH 256
+bool persist_exists(const uint32_t); int persist_get_size(const uint32_t);
+bool persist_read_bool(const uint32_t); int32_t persist_read_int(const uint32_t);
+int persist_read_data(const uint32_t, void*, const size_t); int persist_read_string(const uint32_t, char*, const size_t);
+int persist_write_bool(const uint32_t, const bool); int persist_write_int(const uint32_t, const int32_t);
+int persist_write_data(const uint32_t, const void*, const size_t); int persist_write_string(const uint32_t, const char*);
+int persist_delete(const uint32_t);
+size_t heap_bytes_free(void); size_t heap_bytes_used(void);
+Window *window_create(void); void window_destroy(Window*); void window_stack_push(Window*, bool); void window_set_background_color(Window*, GColor);
+Layer *window_get_root_layer(const Window*);
+typedef struct { void (*load)(Window*); void (*appear)(Window*); void (*disappear)(Window*); void (*unload)(Window*); } WindowHandlers;
+void window_set_window_handlers(Window*, WindowHandlers);
+Layer *layer_create(GRect); Layer *layer_create_with_data(GRect, size_t); void *layer_get_data(const Layer*); void layer_destroy(Layer*);
+void layer_set_update_proc(Layer*, LayerUpdateProc); void layer_mark_dirty(Layer*); void layer_add_child(Layer*, Layer*);
+void layer_set_hidden(Layer*, bool); bool layer_get_hidden(const Layer*); void layer_set_frame(Layer*, GRect);
+TextLayer *text_layer_create(GRect); void text_layer_destroy(TextLayer*); Layer *text_layer_get_layer(TextLayer*);
+void text_layer_set_text(TextLayer*, const char*); void text_layer_set_font(TextLayer*, GFont); void text_layer_set_text_color(TextLayer*, GColor);
+void text_layer_set_background_color(TextLayer*, GColor); void text_layer_set_text_alignment(TextLayer*, GTextAlignment);
+BitmapLayer *bitmap_layer_create(GRect); void bitmap_layer_destroy(BitmapLayer*); Layer *bitmap_layer_get_layer(const BitmapLayer*); void bitmap_layer_set_bitmap(BitmapLayer*, const GBitmap*);
+GBitmap *gbitmap_create_with_resource(uint32_t); GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap*, GRect); void gbitmap_destroy(GBitmap*);
+GFont fonts_load_custom_font(uint32_t); void fonts_unload_custom_font(GFont); GFont fonts_get_system_font(const char*);
+uint32_t resource_get_handle(uint32_t);
+#define FONT_KEY_GOTHIC_14 "g14"
+enum { RESOURCE_ID_FUTURA_30=1, RESOURCE_ID_FUTURA_18, RESOURCE_ID_FUTURA_17, RESOURCE_ID_FUTURA_CONDENSED_53, RESOURCE_ID_ICON_30X30, RESOURCE_ID_ICON_45X45 };
+void graphics_context_set_fill_color(GContext*, GColor); void graphics_context_set_stroke_color(GContext*, GColor);
+void graphics_fill_circle(GContext*, GPoint, uint16_t); void graphics_draw_circle(GContext*, GPoint, uint16_t);
+void app_event_loop(void);
+bool clock_is_24h_style(void);
+uint32_t dict_size(DictionaryIterator*);
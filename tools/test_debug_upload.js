@@ -0,0 +1,184 @@
+/**
+ * Test of the PebbleKit JS logging and debug upload. Loads the JS with stubbed Pebble
+ * and localStorage objects and an XMLHttpRequest posting to a local collector, then
+ * checks the log level gating, the batching of debug messages by size and the flush
+ * of a partial batch after the maximum delay.
+ *
+ * Usage:
+ *   node tools/test_debug_upload.js
+ *
+ * Exits non zero when a check fails.
+ * @file tools/test_debug_upload.js
+ */
+
+var assert = require('assert');
+var http   = require('http');
+var vm     = require('vm');
+var fs     = require('fs');
+var path   = require('path');
+
+var MAX_BYTES = 300;
+var MAX_DELAY = 200; // ms
+var MESSAGES  = 14; // two full batches and a partial one
+
+/**
+ * Collector standing in for the external debug url, keeps every posted batch
+ */
+var Collector = {
+    server:  null,
+    url:     null,
+    batches: [] // { time, entries }
+};
+
+/**
+ * Load the app into a sandbox, its console output is kept in sandbox.printed
+ */
+var loadApp = function()
+{
+    var store = {};
+    var sandbox = {
+        printed: [],
+        setTimeout: setTimeout, clearTimeout: clearTimeout,
+        localStorage: {
+            getItem:    function(k) { return store.hasOwnProperty(k) ? store[k] : null; },
+            setItem:    function(k, v) { store[k] = String(v); },
+            removeItem: function(k) { delete store[k]; }
+        },
+        navigator: { geolocation: {} },
+        Pebble: {
+            addEventListener: function() {},
+            sendAppMessage: function() {},
+            getAccountToken: function() { return 'account'; }
+        },
+        XMLHttpRequest: function() {
+            var method, target;
+            this.open = function(m, u) { method = m; target = u; };
+            this.setRequestHeader = function() {};
+            this.send = function(data) {
+                var req = http.request(target, { method: method });
+                req.end(data || '');
+            };
+        }
+    };
+    sandbox.console = {
+        log:  function(text) { sandbox.printed.push(text); },
+        warn: function(text) { sandbox.printed.push(text); }
+    };
+    vm.createContext(sandbox);
+    vm.runInContext(fs.readFileSync(path.join(__dirname, '../src/js/pebble-js-app.js'), 'utf8'), sandbox);
+    return sandbox;
+};
+
+/**
+ * Wait for ms, then call next
+ */
+var wait = function(ms, next)
+{
+    setTimeout(next, ms);
+};
+
+/**
+ * Debug messages are only built and logged when debugging, errors always
+ */
+var testLevels = function(app)
+{
+    var built = 0;
+    var message = function() { built++; return 'debug message'; };
+
+    app.printed.length = 0;
+    app.logDebug(message);
+    app.logWarn('warn message');
+    app.logError('error message');
+    assert.strictEqual(built, 0, 'filtered debug message was built');
+    assert.deepStrictEqual(app.printed, ['error message'], 'only errors are logged when debug is off');
+
+    app.Global.config.debugEnabled = true;
+    app.printed.length = 0;
+    app.logDebug(message);
+    app.logWarn('warn message');
+    assert.strictEqual(built, 1, 'debug message was not built');
+    assert.deepStrictEqual(app.printed, ['debug message', 'warn message'], 'everything is logged when debugging');
+    app.Global.config.debugEnabled = false;
+    console.log('ok   log level gating');
+};
+
+/**
+ * Messages are posted in batches of about MAX_BYTES, the rest after MAX_DELAY
+ */
+var testBatching = function(app, next)
+{
+    Collector.batches = [];
+    var started = Date.now();
+    var expected = [];
+    for (var i = 0; i < MESSAGES; i++) {
+        expected.push(i);
+        app.postDebugMessage({ i: i, temperature: 140 });
+    }
+    // the size triggered posts are sent at once, the remainder after MAX_DELAY
+    wait(MAX_DELAY / 2, function() {
+        var early = Collector.batches.length;
+        assert.ok(early >= 1, 'no batch was posted once ' + MAX_BYTES + ' bytes were queued');
+        wait(MAX_DELAY * 2, function() {
+            var entries = [];
+            Collector.batches.forEach(function(batch) {
+                entries = entries.concat(batch.entries);
+            });
+            assert.ok(Collector.batches.length > early, 'the partial batch was not flushed');
+            assert.ok(Collector.batches.length < MESSAGES, 'messages were not batched');
+            assert.deepStrictEqual(entries.map(function(e) { return e.data.i; }),
+                                   expected, 'messages lost or reordered');
+            Collector.batches.slice(0, early).forEach(function(batch) {
+                assert.ok(JSON.stringify(batch.entries).length >= MAX_BYTES, 'batch posted before it was full');
+            });
+            console.log('ok   batching, ' + entries.length + ' messages in ' + Collector.batches.length +
+                        ' posts, last after ' + (Collector.batches[Collector.batches.length - 1].time - started) + 'ms');
+            next();
+        });
+    });
+};
+
+/**
+ * A lone message waits MAX_DELAY for company before it is posted
+ */
+var testMaxDelay = function(app, next)
+{
+    Collector.batches = [];
+    var started = Date.now();
+    app.postDebugMessage({ single: true });
+    wait(MAX_DELAY / 2, function() {
+        assert.strictEqual(Collector.batches.length, 0, 'a single message was posted before the delay');
+        wait(MAX_DELAY, function() {
+            assert.strictEqual(Collector.batches.length, 1, 'a single message was not posted after the delay');
+            assert.strictEqual(Collector.batches[0].entries.length, 1);
+            var delay = Collector.batches[0].time - started;
+            assert.ok(delay >= MAX_DELAY, 'posted after ' + delay + 'ms');
+            console.log('ok   max delay flush after ' + delay + 'ms');
+            next();
+        });
+    });
+};
+
+Collector.server = http.createServer(function(req, res) {
+    var body = '';
+    req.on('data', function(chunk) { body += chunk; });
+    req.on('end', function() {
+        var entries = JSON.parse(decodeURIComponent(body.replace(/^data=/, '')));
+        Collector.batches.push({ time: Date.now(), entries: entries });
+        res.end('ok');
+    });
+});
+
+Collector.server.listen(0, '127.0.0.1', function() {
+    Collector.url = 'http://127.0.0.1:' + Collector.server.address().port + '/collect';
+    var app = loadApp();
+    vm.runInContext("EXTERNAL_DEBUG_URL = '" + Collector.url + "';" +
+                    "Global.externalDebug = true;" +
+                    "Global.debugUpload.maxBytes = " + MAX_BYTES + ";" +
+                    "Global.debugUpload.maxDelay = " + MAX_DELAY + ";", app);
+    testLevels(app);
+    testBatching(app, function() {
+        testMaxDelay(app, function() {
+            Collector.server.close();
+        });
+    });
+});